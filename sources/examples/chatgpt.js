@@ -32,7 +32,7 @@ while(!script.isInterrupted()) {
         fl_play_hello = false;
     }
 
-    var event = ivs.getEvent();
+    var event = ivs.waitEvent(1000);
     if(event) {
         consoleLog('notice', "IVS-EVENT: " + JSON.stringify(event));
 
@@ -53,6 +53,4 @@ while(!script.isInterrupted()) {
             }
         }
     }
-
-    msleep(10);
 }
\ No newline at end of file
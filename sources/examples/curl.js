@@ -40,13 +40,11 @@ while(!script.isInterrupted()) {
         send_cnt++;
     }
 
-    var event = ivs.getEvent();
+    var event = ivs.waitEvent(1000);
     if(event) {
         if(event.type == 'curl-done') {
 	    // consoleLog('notice', "CURL-RESPONSE: " + JSON.stringify(event));
             consoleLog('notice', "CURL-RESPONSE: " + event.data.body);
         }
     }
-
-    msleep(10);
 }
@@ -6,6 +6,10 @@ if(typeof(ivs) == 'undefined') {
 ivs.chunkType = 'buffer';
 ivs.chunkEncoding = "b64";
 
+// only what the loop below handles
+ivs.unsubscribe();
+ivs.subscribe(["chunk-ready", "curl-done"]);
+
 var curl = new CURL('http://127.0.0.1/', 'PUT');
 curl.connectTimeout = 2;
 curl.requestTimeout = 10;
@@ -13,7 +17,7 @@ curl.requestTimeout = 10;
 while(!script.isInterrupted()) {
     if(!session.isReady) { break; }
 
-    var event = ivs.getEvent();
+    var event = ivs.waitEvent(1000);
     if(event) {
 	if(event.type == "chunk-ready") {	    
     	    if(event.data.type == 'buffer') {
@@ -24,6 +28,4 @@ while(!script.isInterrupted()) {
             consoleLog('notice', "CURL-RESPONSE: " + event.data.body);
         }
     }
-
-    msleep(10);
 }
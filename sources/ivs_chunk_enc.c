@@ -0,0 +1,395 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#include <ivs_chunk_enc.h>
+#ifdef IVS_WITH_MP3LAME
+#include <lame/lame.h>
+#endif
+#ifdef IVS_WITH_OPUS
+#include <opus/opus.h>
+#include <ogg/ogg.h>
+#endif
+#ifdef IVS_WITH_FLAC
+#include <FLAC/stream_encoder.h>
+#endif
+
+extern globals_t globals;
+
+static inline void put_le16(switch_byte_t *p, uint16_t v) {
+    p[0] = (v & 0xff); p[1] = ((v >> 8) & 0xff);
+}
+
+static inline void put_le32(switch_byte_t *p, uint32_t v) {
+    p[0] = (v & 0xff); p[1] = ((v >> 8) & 0xff); p[2] = ((v >> 16) & 0xff); p[3] = ((v >> 24) & 0xff);
+}
+
+/* growing output buffer, writes go to 'pos' (flac rewrites the header at the end) */
+typedef struct {
+    switch_byte_t   *data;
+    uint32_t        len;
+    uint32_t        size;
+    uint32_t        pos;
+} enc_buffer_t;
+
+static switch_status_t enc_buffer_write(enc_buffer_t *eb, const void *data, uint32_t data_len) {
+    if(eb->pos + data_len > eb->size) {
+        uint32_t nsize = MAX(eb->size * 2, eb->pos + data_len + 4096);
+        switch_byte_t *ndata = realloc(eb->data, nsize);
+        if(ndata == NULL) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+            return SWITCH_STATUS_FALSE;
+        }
+        eb->data = ndata;
+        eb->size = nsize;
+    }
+    memcpy(eb->data + eb->pos, data, data_len);
+    eb->pos += data_len;
+    eb->len = MAX(eb->len, eb->pos);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * true if the encoding can be produced by this build
+ **/
+uint8_t ivs_chunk_encoding_available(uint32_t encoding) {
+    switch(encoding) {
+        case IVS_CHUNK_ENCODING_WAV:
+        case IVS_CHUNK_ENCODING_RAW:
+        case IVS_CHUNK_ENCODING_B64:
+            return true;
+#ifdef IVS_WITH_MP3LAME
+        case IVS_CHUNK_ENCODING_MP3:
+            return true;
+#endif
+#ifdef IVS_WITH_OPUS
+        case IVS_CHUNK_ENCODING_OPUS:
+            return true;
+#endif
+#ifdef IVS_WITH_FLAC
+        case IVS_CHUNK_ENCODING_FLAC:
+            return true;
+#endif
+    }
+    return false;
+}
+
+/**
+ * L16 chunk -> container in memory, the result is malloc'd and owned by the caller.
+ **/
+switch_status_t ivs_chunk_encode(uint32_t encoding, switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint32_t channels, switch_byte_t **out, uint32_t *out_len) {
+    switch(encoding) {
+        case IVS_CHUNK_ENCODING_WAV:
+            return ivs_chunk_encode_wav(data, data_len, samplerate, channels, out, out_len);
+        case IVS_CHUNK_ENCODING_MP3:
+            return ivs_chunk_encode_mp3(data, data_len, samplerate, channels, out, out_len);
+        case IVS_CHUNK_ENCODING_OPUS:
+            return ivs_chunk_encode_opus(data, data_len, samplerate, channels, out, out_len);
+        case IVS_CHUNK_ENCODING_FLAC:
+            return ivs_chunk_encode_flac(data, data_len, samplerate, channels, out, out_len);
+    }
+    return SWITCH_STATUS_NOTIMPL;
+}
+
+switch_status_t ivs_chunk_encode_wav(switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint32_t channels, switch_byte_t **out, uint32_t *out_len) {
+    switch_byte_t *buf = NULL;
+
+    switch_malloc(buf, WAV_HEADER_SIZE + data_len);
+
+    memcpy(buf + 0, "RIFF", 4);
+    put_le32(buf + 4, 36 + data_len);
+    memcpy(buf + 8, "WAVE", 4);
+    memcpy(buf + 12, "fmt ", 4);
+    put_le32(buf + 16, 16);                                 // fmt chunk size
+    put_le16(buf + 20, 1);                                  // PCM
+    put_le16(buf + 22, channels);
+    put_le32(buf + 24, samplerate);
+    put_le32(buf + 28, samplerate * channels * sizeof(int16_t));
+    put_le16(buf + 32, channels * sizeof(int16_t));
+    put_le16(buf + 34, 16);
+    memcpy(buf + 36, "data", 4);
+    put_le32(buf + 40, data_len);
+
+    memcpy(buf + WAV_HEADER_SIZE, data, data_len);
+
+    *out = buf;
+    *out_len = (WAV_HEADER_SIZE + data_len);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t ivs_chunk_encode_mp3(switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint32_t channels, switch_byte_t **out, uint32_t *out_len) {
+#ifdef IVS_WITH_MP3LAME
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    lame_global_flags *gfp = NULL;
+    switch_byte_t *buf = NULL;
+    uint32_t samples = (data_len / (channels * sizeof(int16_t)));
+    uint32_t buf_size = ((samples * 5) / 4) + 7200; // worst case, see lame.h
+    int len = 0, flen = 0;
+
+    if((gfp = lame_init()) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "lame_init() fail\n");
+        return SWITCH_STATUS_FALSE;
+    }
+
+    lame_set_num_channels(gfp, channels);
+    lame_set_in_samplerate(gfp, samplerate);
+    lame_set_mode(gfp, (channels == 1 ? MONO : JOINT_STEREO));
+    lame_set_quality(gfp, 5);
+
+    if(lame_init_params(gfp) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "lame_init_params() fail\n");
+        goto out;
+    }
+
+    switch_malloc(buf, buf_size);
+
+    if(channels == 1) {
+        len = lame_encode_buffer(gfp, (short *)data, NULL, samples, buf, buf_size);
+    } else {
+        len = lame_encode_buffer_interleaved(gfp, (short *)data, samples, buf, buf_size);
+    }
+    if(len < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "lame_encode_buffer() fail (%i)\n", len);
+        goto out;
+    }
+    if((flen = lame_encode_flush(gfp, buf + len, buf_size - len)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "lame_encode_flush() fail (%i)\n", flen);
+        goto out;
+    }
+
+    *out = buf;
+    *out_len = (len + flen);
+    status = SWITCH_STATUS_SUCCESS;
+out:
+    if(status != SWITCH_STATUS_SUCCESS) {
+        switch_safe_free(buf);
+    }
+    lame_close(gfp);
+    return status;
+#else
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "mp3 encoding is not available (built without IVS_WITH_MP3LAME)\n");
+    return SWITCH_STATUS_NOTIMPL;
+#endif
+}
+
+#ifdef IVS_WITH_OPUS
+/* the closest rate the encoder takes (upwards) */
+static inline uint32_t opus_samplerate(uint32_t samplerate) {
+    if(samplerate <= 8000)  { return 8000; }
+    if(samplerate <= 12000) { return 12000; }
+    if(samplerate <= 16000) { return 16000; }
+    if(samplerate <= 24000) { return 24000; }
+    return 48000;
+}
+
+static switch_status_t ogg_write_pages(ogg_stream_state *os, enc_buffer_t *eb, uint8_t fl_flush) {
+    ogg_page og;
+
+    while(fl_flush ? ogg_stream_flush(os, &og) : ogg_stream_pageout(os, &og)) {
+        if(enc_buffer_write(eb, og.header, og.header_len) != SWITCH_STATUS_SUCCESS) { return SWITCH_STATUS_FALSE; }
+        if(enc_buffer_write(eb, og.body, og.body_len) != SWITCH_STATUS_SUCCESS) { return SWITCH_STATUS_FALSE; }
+    }
+    return SWITCH_STATUS_SUCCESS;
+}
+#endif
+
+/**
+ * Ogg Opus (RFC 7845), 20ms frames, granule positions are always at 48kHz
+ * other rates (11025, 22050, 32000, 44100) are resampled up to the closest one opus takes
+ **/
+switch_status_t ivs_chunk_encode_opus(switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint32_t channels, switch_byte_t **out, uint32_t *out_len) {
+#ifdef IVS_WITH_OPUS
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    OpusEncoder *enc = NULL;
+    switch_audio_resampler_t *resampler = NULL;
+    ogg_stream_state os = { 0 };
+    ogg_packet op = { 0 };
+    enc_buffer_t eb = { 0 };
+    switch_byte_t head[19] = { 0 }, tags[8 + 4 + 3 + 4] = { 0 };
+    unsigned char pkt[1500] = { 0 };
+    int16_t *pcm = (int16_t *)data, *frame = NULL;
+    uint32_t samples = (data_len / (channels * sizeof(int16_t)));
+    uint32_t enc_samplerate = opus_samplerate(samplerate);
+    uint32_t frame_samples = (enc_samplerate / 50);
+    uint32_t scale = (48000 / enc_samplerate), offs = 0, total = 0;
+    int32_t lookahead = 0;
+    int err = 0, len = 0;
+
+    if(enc_samplerate != samplerate) {
+        if(switch_resample_create(&resampler, samplerate, enc_samplerate, samples, SWITCH_RESAMPLE_QUALITY, channels) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "opus: unable to create resampler (%u => %u)\n", samplerate, enc_samplerate);
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_resample_process(resampler, pcm, samples);
+        pcm = resampler->to;
+        samples = resampler->to_len;
+    }
+
+    if((enc = opus_encoder_create(enc_samplerate, channels, OPUS_APPLICATION_VOIP, &err)) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "opus_encoder_create() fail (%s)\n", opus_strerror(err));
+        if(resampler) { switch_resample_destroy(&resampler); }
+        return SWITCH_STATUS_FALSE;
+    }
+    opus_encoder_ctl(enc, OPUS_SET_BITRATE(globals.cfg_opus_bitrate));
+    opus_encoder_ctl(enc, OPUS_SET_COMPLEXITY(globals.cfg_opus_complexity));
+    opus_encoder_ctl(enc, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+    opus_encoder_ctl(enc, OPUS_GET_LOOKAHEAD(&lookahead));
+    total = (samples + (uint32_t)lookahead);
+
+    ogg_stream_init(&os, (int)switch_micro_time_now());
+
+    // OpusHead
+    memcpy(head, "OpusHead", 8);
+    head[8] = 1;
+    head[9] = channels;
+    put_le16(head + 10, (lookahead * scale));
+    put_le32(head + 12, samplerate);
+
+    op.packet = head; op.bytes = sizeof(head); op.b_o_s = 1; op.granulepos = 0; op.packetno = 0;
+    ogg_stream_packetin(&os, &op);
+    if(ogg_write_pages(&os, &eb, true) != SWITCH_STATUS_SUCCESS) { goto out; }
+
+    // OpusTags
+    memcpy(tags, "OpusTags", 8);
+    put_le32(tags + 8, 3);
+    memcpy(tags + 12, "ivs", 3);
+    put_le32(tags + 15, 0);
+
+    op.packet = tags; op.bytes = sizeof(tags); op.b_o_s = 0; op.packetno = 1;
+    ogg_stream_packetin(&os, &op);
+    if(ogg_write_pages(&os, &eb, true) != SWITCH_STATUS_SUCCESS) { goto out; }
+
+    switch_zmalloc(frame, frame_samples * channels * sizeof(int16_t));
+
+    // the encoder delays the signal by 'lookahead', keep feeding silence until everything came out
+    while(offs < total) {
+        uint32_t n = (offs < samples ? MIN(frame_samples, samples - offs) : 0);
+
+        if(n > 0) {
+            memcpy(frame, pcm + (offs * channels), n * channels * sizeof(int16_t));
+        }
+        if(n < frame_samples) {
+            memset(frame + (n * channels), 0, (frame_samples - n) * channels * sizeof(int16_t));
+        }
+
+        if((len = opus_encode(enc, frame, frame_samples, pkt, sizeof(pkt))) < 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "opus_encode() fail (%s)\n", opus_strerror(len));
+            goto out;
+        }
+        offs += frame_samples;
+
+        op.packet = pkt;
+        op.bytes = len;
+        op.packetno++;
+        op.e_o_s = (offs >= total);
+        op.granulepos = ((ogg_int64_t)MIN(offs, total) * scale);
+
+        ogg_stream_packetin(&os, &op);
+        if(ogg_write_pages(&os, &eb, op.e_o_s) != SWITCH_STATUS_SUCCESS) { goto out; }
+    }
+
+    *out = eb.data;
+    *out_len = eb.len;
+    status = SWITCH_STATUS_SUCCESS;
+out:
+    if(status != SWITCH_STATUS_SUCCESS) {
+        switch_safe_free(eb.data);
+    }
+    switch_safe_free(frame);
+    ogg_stream_clear(&os);
+    opus_encoder_destroy(enc);
+    if(resampler) {
+        switch_resample_destroy(&resampler);
+    }
+    return status;
+#else
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "opus encoding is not available (built without IVS_WITH_OPUS)\n");
+    return SWITCH_STATUS_NOTIMPL;
+#endif
+}
+
+#ifdef IVS_WITH_FLAC
+static FLAC__StreamEncoderWriteStatus flac_write_cb(const FLAC__StreamEncoder *encoder, const FLAC__byte buffer[], size_t bytes, uint32_t samples, uint32_t current_frame, void *client_data) {
+    enc_buffer_t *eb = (enc_buffer_t *)client_data;
+    return (enc_buffer_write(eb, buffer, bytes) == SWITCH_STATUS_SUCCESS ? FLAC__STREAM_ENCODER_WRITE_STATUS_OK : FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR);
+}
+
+static FLAC__StreamEncoderSeekStatus flac_seek_cb(const FLAC__StreamEncoder *encoder, FLAC__uint64 absolute_byte_offset, void *client_data) {
+    enc_buffer_t *eb = (enc_buffer_t *)client_data;
+    if(absolute_byte_offset > eb->len) {
+        return FLAC__STREAM_ENCODER_SEEK_STATUS_ERROR;
+    }
+    eb->pos = absolute_byte_offset;
+    return FLAC__STREAM_ENCODER_SEEK_STATUS_OK;
+}
+
+static FLAC__StreamEncoderTellStatus flac_tell_cb(const FLAC__StreamEncoder *encoder, FLAC__uint64 *absolute_byte_offset, void *client_data) {
+    enc_buffer_t *eb = (enc_buffer_t *)client_data;
+    *absolute_byte_offset = eb->pos;
+    return FLAC__STREAM_ENCODER_TELL_STATUS_OK;
+}
+#endif
+
+switch_status_t ivs_chunk_encode_flac(switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint32_t channels, switch_byte_t **out, uint32_t *out_len) {
+#ifdef IVS_WITH_FLAC
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    FLAC__StreamEncoder *enc = NULL;
+    FLAC__int32 *ibuf = NULL;
+    enc_buffer_t eb = { 0 };
+    int16_t *pcm = (int16_t *)data;
+    uint32_t samples = (data_len / (channels * sizeof(int16_t)));
+    uint32_t block = 1024, offs = 0;
+
+    if((enc = FLAC__stream_encoder_new()) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "FLAC__stream_encoder_new() fail\n");
+        return SWITCH_STATUS_FALSE;
+    }
+
+    FLAC__stream_encoder_set_channels(enc, channels);
+    FLAC__stream_encoder_set_bits_per_sample(enc, 16);
+    FLAC__stream_encoder_set_sample_rate(enc, samplerate);
+    FLAC__stream_encoder_set_compression_level(enc, globals.cfg_flac_level);
+    FLAC__stream_encoder_set_total_samples_estimate(enc, samples);
+
+    if(FLAC__stream_encoder_init_stream(enc, flac_write_cb, flac_seek_cb, flac_tell_cb, NULL, &eb) != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "FLAC__stream_encoder_init_stream() fail\n");
+        FLAC__stream_encoder_delete(enc);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch_malloc(ibuf, block * channels * sizeof(FLAC__int32));
+
+    while(offs < samples) {
+        uint32_t n = MIN(block, samples - offs);
+
+        for(uint32_t i = 0; i < n * channels; i++) {
+            ibuf[i] = pcm[(offs * channels) + i];
+        }
+        if(!FLAC__stream_encoder_process_interleaved(enc, ibuf, n)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "FLAC__stream_encoder_process() fail\n");
+            FLAC__stream_encoder_finish(enc);
+            goto out;
+        }
+        offs += n;
+    }
+
+    if(!FLAC__stream_encoder_finish(enc)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "FLAC__stream_encoder_finish() fail\n");
+        goto out;
+    }
+
+    *out = eb.data;
+    *out_len = eb.len;
+    status = SWITCH_STATUS_SUCCESS;
+out:
+    if(status != SWITCH_STATUS_SUCCESS) {
+        switch_safe_free(eb.data);
+    }
+    switch_safe_free(ibuf);
+    FLAC__stream_encoder_delete(enc);
+    return status;
+#else
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "flac encoding is not available (built without IVS_WITH_FLAC)\n");
+    return SWITCH_STATUS_NOTIMPL;
+#endif
+}
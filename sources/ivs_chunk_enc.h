@@ -0,0 +1,20 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#ifndef IVS_CHUNK_ENC_H
+#define IVS_CHUNK_ENC_H
+
+#include <mod_ivs.h>
+
+#define WAV_HEADER_SIZE                 44
+
+uint8_t ivs_chunk_encoding_available(uint32_t encoding);
+switch_status_t ivs_chunk_encode(uint32_t encoding, switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint32_t channels, switch_byte_t **out, uint32_t *out_len);
+switch_status_t ivs_chunk_encode_wav(switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint32_t channels, switch_byte_t **out, uint32_t *out_len);
+switch_status_t ivs_chunk_encode_mp3(switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint32_t channels, switch_byte_t **out, uint32_t *out_len);
+switch_status_t ivs_chunk_encode_opus(switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint32_t channels, switch_byte_t **out, uint32_t *out_len);
+switch_status_t ivs_chunk_encode_flac(switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint32_t channels, switch_byte_t **out, uint32_t *out_len);
+
+
+#endif
@@ -0,0 +1,432 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#include <ivs_chunk_store.h>
+#include <ivs_chunk_enc.h>
+#include <js_ivs_hlp.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+extern globals_t globals;
+
+/**
+ * chunk files handed over to the scripts (chunkType = 'file').
+ * every file starts with one reference that belongs to the event (and then to the script),
+ * consumers (curl, whisper, playback) take their own one while they are working with the file.
+ * the holder reference is dropped when the first consumer finishes, by unlink() from the script or when the session ends,
+ * the file is removed as soon as nobody holds it anymore.
+ * entries are only visible to the session they belong to (kept per session, hashed by session_id).
+ * memfd files are given to the scripts as /proc/self/fd/N#G (G - generation, never reused),
+ * the fd numbers are recycled by the kernel, so a stale path must not resolve to somebody else's file.
+ * such a path is only resolved by the module consumers (playback, curl, whisper, unlink),
+ * for external tools the store should be a directory (tmpfs).
+ **/
+typedef struct chunk_store_entry_s {
+    char                        *path;
+    char                        *fd_path;   // memfd: /proc/self/fd/N (what consumers open)
+    char                        *play_path; // memfd: <ext>:///proc/self/fd/N (the file module is picked by the prefix)
+    char                        *name;      // name with extension (memfd paths don't have it)
+    int                         fd;
+    uint32_t                    refs;
+    uint8_t                     fl_held;    // holder reference still there
+    struct chunk_store_entry_s  *next;
+} chunk_store_entry_t;
+
+typedef struct {
+    char                        *session_id;
+    chunk_store_entry_t         *entries;
+} chunk_store_bucket_t;
+
+static switch_mutex_t *store_mutex = NULL;
+static switch_hash_t *store_buckets = NULL;
+static uint32_t store_type = IVS_CHUNK_STORE_TEMP;
+static char *store_dir = NULL;
+static uint32_t store_generation = 0;
+
+static int chunk_memfd_create(const char *name) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+    return syscall(SYS_memfd_create, name, MFD_CLOEXEC);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void entry_destroy(chunk_store_entry_t *entry) {
+    if(entry->fd >= 0) {
+        close(entry->fd);
+    } else {
+        unlink(entry->path);
+    }
+    switch_safe_free(entry->path);
+    switch_safe_free(entry->fd_path);
+    switch_safe_free(entry->play_path);
+    switch_safe_free(entry->name);
+    switch_safe_free(entry);
+}
+
+/* must be called under store_mutex, the bucket goes away with the last entry */
+static void bucket_remove(chunk_store_bucket_t *bucket, chunk_store_entry_t *entry) {
+    chunk_store_entry_t *prev = NULL, *cur = NULL;
+
+    for(cur = bucket->entries; cur; prev = cur, cur = cur->next) {
+        if(cur == entry) {
+            if(prev) { prev->next = cur->next; }
+            else { bucket->entries = cur->next; }
+            break;
+        }
+    }
+
+    if(!bucket->entries) {
+        switch_core_hash_delete(store_buckets, bucket->session_id);
+        switch_safe_free(bucket->session_id);
+        switch_safe_free(bucket);
+    }
+}
+
+/* must be called under store_mutex, returns true if the entry was removed */
+static uint8_t entry_unref(chunk_store_bucket_t *bucket, chunk_store_entry_t *entry, uint8_t fl_holder) {
+
+    if(fl_holder) {
+        if(!entry->fl_held) { return false; }
+        entry->fl_held = false;
+    }
+    if(entry->refs > 0) {
+        entry->refs--;
+    }
+    if(entry->refs > 0) {
+        return false;
+    }
+
+    bucket_remove(bucket, entry);
+    entry_destroy(entry);
+    return true;
+}
+
+/* must be called under store_mutex, only the session's own files are looked through */
+static chunk_store_entry_t *entry_lookup(const char *session_id, const char *path, chunk_store_bucket_t **bucket_out) {
+    chunk_store_bucket_t *bucket = NULL;
+    chunk_store_entry_t *entry = NULL;
+
+    if(!store_buckets || zstr(session_id) || zstr(path)) { return NULL; }
+
+    if((bucket = switch_core_hash_find(store_buckets, session_id)) == NULL) {
+        return NULL;
+    }
+    for(entry = bucket->entries; entry; entry = entry->next) {
+        if(!strcmp(entry->path, path)) { break; }
+    }
+    if(entry && bucket_out) {
+        *bucket_out = bucket;
+    }
+    return entry;
+}
+
+static switch_status_t fd_write_all(int fd, switch_byte_t *data, uint32_t data_len) {
+    uint32_t offs = 0;
+
+    while(offs < data_len) {
+        ssize_t n = write(fd, data + offs, data_len - offs);
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR) { continue; }
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "write fail (%s)\n", strerror(errno));
+            return SWITCH_STATUS_FALSE;
+        }
+        offs += n;
+    }
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * encoded chunk -> memfd or a file in the store dir
+ * fd_out is set for memfd (the descriptor keeps the file alive)
+ **/
+static char *encoded_write(switch_byte_t *data, uint32_t data_len, const char *file_ext, int *fd_out) {
+    char name_uuid[SWITCH_UUID_FORMATTED_LENGTH + 1] = { 0 };
+    char *path = NULL;
+    int fd = -1;
+
+    if(store_type == IVS_CHUNK_STORE_MEMFD) {
+        if((fd = chunk_memfd_create("ivs-chunk")) < 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "memfd_create() fail (%s)\n", strerror(errno));
+            return NULL;
+        }
+        if(fd_write_all(fd, data, data_len) != SWITCH_STATUS_SUCCESS) {
+            close(fd);
+            return NULL;
+        }
+        *fd_out = fd;
+
+        switch_mutex_lock(store_mutex);
+        store_generation++;
+        path = switch_mprintf("/proc/self/fd/%i#%u", fd, store_generation);
+        switch_mutex_unlock(store_mutex);
+
+        return path;
+    }
+
+    switch_uuid_str((char *)name_uuid, sizeof(name_uuid));
+    path = switch_mprintf("%s%s%s.%s", store_dir, SWITCH_PATH_SEPARATOR, name_uuid, file_ext);
+
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Open fail: %s (%s)\n", path, strerror(errno));
+        switch_safe_free(path);
+        return NULL;
+    }
+    if(fd_write_all(fd, data, data_len) != SWITCH_STATUS_SUCCESS) {
+        close(fd);
+        unlink(path);
+        switch_safe_free(path);
+        return NULL;
+    }
+    close(fd);
+
+    return path;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// public
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+/**
+ * store: temp (default) | memfd | path to a directory (preferably on tmpfs)
+ **/
+switch_status_t ivs_chunk_store_init(switch_memory_pool_t *pool, const char *store) {
+
+    switch_mutex_init(&store_mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_core_hash_init(&store_buckets);
+
+    store_type = IVS_CHUNK_STORE_TEMP;
+    store_dir = SWITCH_GLOBAL_dirs.temp_dir;
+
+    if(zstr(store) || !strcasecmp(store, "temp")) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if(!strcasecmp(store, "memfd")) {
+        int fd = chunk_memfd_create("ivs-probe");
+        if(fd < 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "memfd isn't available, chunk files will go to: %s\n", store_dir);
+            return SWITCH_STATUS_SUCCESS;
+        }
+        close(fd);
+        store_type = IVS_CHUNK_STORE_MEMFD;
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if(switch_directory_exists(store, pool) != SWITCH_STATUS_SUCCESS) {
+        if(switch_dir_make_recursive(store, SWITCH_DEFAULT_DIR_PERMS, pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unable to create directory: %s (chunk files will go to: %s)\n", store, store_dir);
+            return SWITCH_STATUS_SUCCESS;
+        }
+    }
+
+    store_type = IVS_CHUNK_STORE_DIR;
+    store_dir = switch_core_strdup(pool, store);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void ivs_chunk_store_shutdown() {
+    switch_hash_index_t *hi = NULL;
+    chunk_store_entry_t *entry = NULL, *next = NULL;
+    void *hval = NULL;
+
+    if(!store_mutex || !store_buckets) { return; }
+
+    switch_mutex_lock(store_mutex);
+    for(hi = switch_core_hash_first_iter(store_buckets, hi); hi; hi = switch_core_hash_next(&hi)) {
+        chunk_store_bucket_t *bucket = NULL;
+
+        switch_core_hash_this(hi, NULL, NULL, &hval);
+        bucket = (chunk_store_bucket_t *)hval;
+
+        for(entry = bucket->entries; entry; entry = next) {
+            next = entry->next;
+            entry_destroy(entry);
+        }
+        switch_safe_free(bucket->session_id);
+        switch_safe_free(bucket);
+    }
+    switch_safe_free(hi);
+    switch_core_hash_destroy(&store_buckets);
+    switch_mutex_unlock(store_mutex);
+}
+
+const char *ivs_chunk_store_dir() {
+    return (store_dir ? store_dir : SWITCH_GLOBAL_dirs.temp_dir);
+}
+
+/**
+ * returns a new path (should be freed by the caller) which belongs to the store
+ **/
+char *ivs_chunk_store_write(ivs_session_t *ivs_session, switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint32_t channels, uint32_t encoding) {
+    const char *file_ext = ivs_chunkEncoding2ext(encoding);
+    chunk_store_bucket_t *bucket = NULL;
+    chunk_store_entry_t *entry = NULL;
+    switch_byte_t *enc_buffer = NULL;
+    uint32_t enc_buffer_len = 0;
+    char *path = NULL;
+    int fd = -1;
+
+    // encoded in-process (wav, mp3, opus, flac), freeswitch file modules are the fallback
+    // (not for opus: a FS written .ogg would be vorbis)
+    if(ivs_chunk_encode(encoding, data, data_len, samplerate, channels, &enc_buffer, &enc_buffer_len) == SWITCH_STATUS_SUCCESS) {
+        path = encoded_write(enc_buffer, enc_buffer_len, file_ext, &fd);
+        switch_safe_free(enc_buffer);
+    }
+    if(path == NULL && encoding != IVS_CHUNK_ENCODING_OPUS) {
+        path = audio_file_write(data, data_len, samplerate, channels, file_ext);
+    }
+    if(path == NULL) {
+        return NULL;
+    }
+
+    switch_zmalloc(entry, sizeof(chunk_store_entry_t));
+    entry->path = strdup(path);
+    entry->fd_path = (fd >= 0 ? switch_mprintf("/proc/self/fd/%i", fd) : NULL);
+    entry->play_path = (fd >= 0 ? switch_mprintf("%s:///proc/self/fd/%i", file_ext, fd) : NULL);
+    entry->name = (fd >= 0 ? switch_mprintf("chunk-%i.%s", fd, file_ext) : NULL);
+    entry->fd = fd;
+    entry->refs = 1;
+    entry->fl_held = true;
+
+    switch_mutex_lock(store_mutex);
+    if((bucket = switch_core_hash_find(store_buckets, ivs_session->session_id)) == NULL) {
+        switch_zmalloc(bucket, sizeof(chunk_store_bucket_t));
+        bucket->session_id = strdup(ivs_session->session_id);
+        switch_core_hash_insert(store_buckets, bucket->session_id, bucket);
+    }
+    entry->next = bucket->entries;
+    bucket->entries = entry;
+    switch_mutex_unlock(store_mutex);
+
+    return path;
+}
+
+/**
+ * consumer is going to use the file, returns false if the path doesn't belong to the session's store
+ * name (optional): file name to announce (memfd paths don't have an extension)
+ * fpath (optional): path to open, valid until ivs_chunk_store_done()
+ **/
+uint8_t ivs_chunk_store_take(const char *session_id, const char *path, switch_memory_pool_t *pool, char **name, const char **fpath) {
+    chunk_store_entry_t *entry = NULL;
+
+    if(!store_mutex) { return false; }
+
+    switch_mutex_lock(store_mutex);
+    if((entry = entry_lookup(session_id, path, NULL)) != NULL) {
+        entry->refs++;
+        if(name && pool) {
+            *name = switch_core_strdup(pool, (entry->name ? entry->name : switch_cut_path(entry->path)));
+        }
+        if(fpath) {
+            *fpath = (entry->fd_path ? entry->fd_path : entry->path);
+        }
+    }
+    switch_mutex_unlock(store_mutex);
+
+    return (entry != NULL);
+}
+
+/**
+ * the same as take, ppath is what switch_ivr_play_file() can open
+ * (memfd: the format goes as the prefix, the fd path has no extension)
+ **/
+uint8_t ivs_chunk_store_take_playback(const char *session_id, const char *path, const char **ppath) {
+    chunk_store_entry_t *entry = NULL;
+
+    if(!store_mutex) { return false; }
+
+    switch_mutex_lock(store_mutex);
+    if((entry = entry_lookup(session_id, path, NULL)) != NULL) {
+        entry->refs++;
+        if(ppath) {
+            *ppath = (entry->play_path ? entry->play_path : entry->path);
+        }
+    }
+    switch_mutex_unlock(store_mutex);
+
+    return (entry != NULL);
+}
+
+/**
+ * true if the path is a live file of the session's store
+ **/
+uint8_t ivs_chunk_store_exists(const char *session_id, const char *path) {
+    uint8_t fl_found = false;
+
+    if(!store_mutex) { return false; }
+
+    switch_mutex_lock(store_mutex);
+    fl_found = (entry_lookup(session_id, path, NULL) != NULL);
+    switch_mutex_unlock(store_mutex);
+
+    return fl_found;
+}
+
+/**
+ * consumer has finished, the file isn't needed anymore
+ **/
+void ivs_chunk_store_done(const char *session_id, const char *path) {
+    chunk_store_bucket_t *bucket = NULL;
+    chunk_store_entry_t *entry = NULL;
+
+    if(!store_mutex) { return; }
+
+    switch_mutex_lock(store_mutex);
+    if((entry = entry_lookup(session_id, path, &bucket)) != NULL) {
+        if(entry->fl_held && entry->refs > 1) {
+            entry->fl_held = false;
+            entry->refs--;
+        }
+        entry_unref(bucket, entry, false);
+    }
+    switch_mutex_unlock(store_mutex);
+}
+
+/**
+ * explicit delete (script), files outside the store are just unlinked
+ **/
+void ivs_chunk_store_unlink(const char *session_id, const char *path) {
+    chunk_store_bucket_t *bucket = NULL;
+    chunk_store_entry_t *entry = NULL;
+
+    if(zstr(path)) { return; }
+
+    if(store_mutex) {
+        switch_mutex_lock(store_mutex);
+        if((entry = entry_lookup(session_id, path, &bucket)) != NULL) {
+            entry_unref(bucket, entry, true);
+        }
+        switch_mutex_unlock(store_mutex);
+    }
+
+    if(!entry && strncmp(path, "/proc/self/fd/", 14)) {
+        unlink(path);
+    }
+}
+
+void ivs_chunk_store_session_cleanup(const char *session_id) {
+    chunk_store_bucket_t *bucket = NULL;
+    chunk_store_entry_t *entry = NULL, *next = NULL;
+
+    if(!store_mutex || zstr(session_id)) { return; }
+
+    switch_mutex_lock(store_mutex);
+    if(store_buckets && (bucket = switch_core_hash_find(store_buckets, session_id)) != NULL) {
+        // the bucket goes away together with the last entry (next is NULL by then)
+        for(entry = bucket->entries; entry; entry = next) {
+            next = entry->next;
+            entry_unref(bucket, entry, true);
+        }
+    }
+    switch_mutex_unlock(store_mutex);
+}
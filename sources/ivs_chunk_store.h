@@ -0,0 +1,27 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#ifndef IVS_CHUNK_STORE_H
+#define IVS_CHUNK_STORE_H
+
+#include <mod_ivs.h>
+
+#define IVS_CHUNK_STORE_TEMP            0 // freeswitch temp dir
+#define IVS_CHUNK_STORE_DIR             1 // dedicated (tmpfs) directory
+#define IVS_CHUNK_STORE_MEMFD           2 // memfd_create(), exposed as /proc/self/fd/N#G (played as <ext>:///proc/self/fd/N)
+
+switch_status_t ivs_chunk_store_init(switch_memory_pool_t *pool, const char *store);
+void ivs_chunk_store_shutdown();
+const char *ivs_chunk_store_dir();
+
+char *ivs_chunk_store_write(ivs_session_t *ivs_session, switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint32_t channels, uint32_t encoding);
+uint8_t ivs_chunk_store_take(const char *session_id, const char *path, switch_memory_pool_t *pool, char **name, const char **fpath);
+uint8_t ivs_chunk_store_take_playback(const char *session_id, const char *path, const char **ppath);
+uint8_t ivs_chunk_store_exists(const char *session_id, const char *path);
+void ivs_chunk_store_done(const char *session_id, const char *path);
+void ivs_chunk_store_unlink(const char *session_id, const char *path);
+void ivs_chunk_store_session_cleanup(const char *session_id);
+
+
+#endif
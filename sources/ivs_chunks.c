@@ -0,0 +1,317 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#include <ivs_chunks.h>
+#include <ivs_events.h>
+#include <js_ivs_hlp.h>
+#include <ivs_chunk_enc.h>
+#include <ivs_chunk_store.h>
+
+#include <math.h>
+
+#define CHUNK_COMPACT_BLOCK_MS      10
+#define CHUNK_COMPACT_EDGE_MS       100     // silence kept before the first / after the last voiced block
+#define CHUNK_COMPACT_THRESHOLD     200     // rms, if vad-threshold isn't set
+
+extern globals_t globals;
+
+static inline uint32_t chunk_duration_ms(ivs_session_t *ivs_session, uint32_t data_len) {
+    return (uint32_t)(((uint64_t)data_len * 1000) / (ivs_session->chunk_rate * ivs_session->channels * sizeof(int16_t)));
+}
+
+static uint8_t block_voiced(int16_t *samples, uint32_t count, double thresh) {
+    double energy = 0;
+
+    for(uint32_t i = 0; i < count; i++) {
+        energy += ((double)samples[i] * samples[i]);
+    }
+    return (count > 0 && sqrt(energy / count) >= thresh);
+}
+
+/**
+ * drops the leading/trailing silence (keeps CHUNK_COMPACT_EDGE_MS) and shortens the pauses inside to pause_ms.
+ * works on 10ms blocks, the result goes to out (at least data_len), returns its length.
+ * a chunk without voiced blocks is left as it is (vad has already taken it as speech).
+ **/
+static uint32_t chunk_compact(ivs_session_t *ivs_session, switch_byte_t *data, uint32_t data_len, switch_byte_t *out, uint32_t pause_ms, uint32_t vad_threshold) {
+    uint32_t block_bytes = ((ivs_session->chunk_rate * CHUNK_COMPACT_BLOCK_MS) / 1000) * ivs_session->channels * sizeof(int16_t);
+    uint32_t blocks = (data_len + block_bytes - 1) / block_bytes;
+    uint32_t edge_blocks = (CHUNK_COMPACT_EDGE_MS / CHUNK_COMPACT_BLOCK_MS);
+    uint32_t pause_blocks = (pause_ms / CHUNK_COMPACT_BLOCK_MS);
+    double thresh = (vad_threshold > 0 ? vad_threshold : CHUNK_COMPACT_THRESHOLD);
+    uint32_t first = 0, last = 0, out_len = 0, silence_start = 0, silence_len = 0;
+    uint8_t fl_voiced_found = false;
+
+    if(!block_bytes || blocks < 2) {
+        memcpy(out, data, data_len);
+        return data_len;
+    }
+
+    // voiced range
+    for(uint32_t b = 0; b < blocks; b++) {
+        uint32_t offs = (b * block_bytes), len = MIN(block_bytes, data_len - offs);
+        if(block_voiced((int16_t *)(data + offs), (len / sizeof(int16_t)), thresh)) {
+            if(!fl_voiced_found) { first = b; fl_voiced_found = true; }
+            last = b;
+        }
+    }
+    if(!fl_voiced_found) {
+        memcpy(out, data, data_len);
+        return data_len;
+    }
+
+    first = (first > edge_blocks ? first - edge_blocks : 0);
+    last = MIN(last + edge_blocks, blocks - 1);
+
+    for(uint32_t b = first; b <= last; b++) {
+        uint32_t offs = (b * block_bytes), len = MIN(block_bytes, data_len - offs);
+        uint8_t fl_voiced = block_voiced((int16_t *)(data + offs), (len / sizeof(int16_t)), thresh);
+
+        if(!fl_voiced && b != last) {
+            if(!silence_len) { silence_start = b; }
+            silence_len++;
+            continue;
+        }
+
+        // flush the pause: as it is or its head and tail (pause_ms in total)
+        if(silence_len) {
+            if(!pause_blocks || silence_len <= pause_blocks) {
+                memcpy(out + out_len, data + (silence_start * block_bytes), (silence_len * block_bytes));
+                out_len += (silence_len * block_bytes);
+            } else {
+                uint32_t head = (pause_blocks / 2), tail = (pause_blocks - head);
+                memcpy(out + out_len, data + (silence_start * block_bytes), (head * block_bytes));
+                out_len += (head * block_bytes);
+                memcpy(out + out_len, data + ((b - tail) * block_bytes), (tail * block_bytes));
+                out_len += (tail * block_bytes);
+            }
+            silence_len = 0;
+        }
+
+        memcpy(out + out_len, data + offs, len);
+        out_len += len;
+    }
+
+    return out_len;
+}
+
+static void chunk_emit(ivs_session_t *ivs_session, uint32_t chunk_mode, switch_byte_t *data, uint32_t data_len, uint8_t fl_final, uint8_t fl_eou) {
+    ivs_event_payload_mchunk_t hdr = { 0 };
+    switch_byte_t *compact_buffer = NULL;
+    uint32_t vad_threshold = 0;
+    uint8_t fl_compact = false;
+
+    if(!data_len) {
+        return;
+    }
+    switch_mutex_lock(ivs_session->mutex);
+    hdr.type = ivs_session->chunk_type;
+    hdr.encoding = ivs_session->chunk_encoding;
+    // stream partials share the overlap region with the next one, they go as is
+    fl_compact = (ivs_session->fl_chunk_compact && (chunk_mode != IVS_CHUNK_MODE_STREAM || fl_final));
+    vad_threshold = ivs_session->vad_threshold;
+    if(fl_eou) {
+        hdr.endpoint = ivs_session->ep_decision;
+        memset(&ivs_session->ep_decision, 0, sizeof(ivs_endpoint_decision_t));
+    }
+    switch_mutex_unlock(ivs_session->mutex);
+
+    // nobody listens (ivs.unsubscribe), don't even compact/encode
+    if(!ivs_events_wanted(IVS_EVENTSQ(ivs_session), IVS_EVENT_CHUNK_READY)) {
+        ivs_session->chunk_seq++;
+        return;
+    }
+
+    hdr.orig_duration_ms = chunk_duration_ms(ivs_session, data_len);
+
+    if(fl_compact) {
+        switch_malloc(compact_buffer, data_len);
+        data_len = chunk_compact(ivs_session, data, data_len, compact_buffer, globals.cfg_chunk_compact_pause_ms, vad_threshold);
+        data = compact_buffer;
+    }
+
+    hdr.duration_ms = chunk_duration_ms(ivs_session, data_len);
+    hdr.samplerate = ivs_session->chunk_rate;
+    hdr.channels = ivs_session->channels;
+    hdr.time = (data_len / (ivs_session->chunk_rate * ivs_session->channels * sizeof(int16_t)));
+    hdr.length = data_len;
+    hdr.utterance = ivs_session->chunk_utterance;
+    hdr.seq = ivs_session->chunk_seq;
+    hdr.final = fl_final;
+
+    ivs_session->chunk_seq++;
+
+    if(hdr.type == IVS_CHUNK_TYPE_FILE) {
+        char *ofname = ivs_chunk_store_write(ivs_session, data, data_len, hdr.samplerate, hdr.channels, hdr.encoding);
+        if(ofname) {
+            if(ivs_event_push_chunk_ready(IVS_EVENTSQ(ivs_session), &hdr, ofname, strlen(ofname)) != SWITCH_STATUS_SUCCESS) {
+                ivs_chunk_store_unlink(ivs_session->session_id, ofname);
+            }
+            switch_safe_free(ofname);
+        }
+    } else if(hdr.type == IVS_CHUNK_TYPE_BUFFER) {
+        if(hdr.encoding == IVS_CHUNK_ENCODING_RAW) {
+            if(compact_buffer) {
+                // already a copy, hand it over
+                ivs_event_push_chunk_ready_zerocopy(IVS_EVENTSQ(ivs_session), &hdr, compact_buffer, data_len);
+                compact_buffer = NULL;
+            } else {
+                ivs_event_push_chunk_ready(IVS_EVENTSQ(ivs_session), &hdr, data, data_len);
+            }
+        } else if(hdr.encoding == IVS_CHUNK_ENCODING_B64) {
+            switch_byte_t *b64_buffer = NULL;
+            uint32_t b64_buffer_len = BASE64_ENC_SZ(data_len);
+
+            switch_malloc(b64_buffer, b64_buffer_len);
+            if(switch_b64_encode((uint8_t *)data, data_len, b64_buffer, b64_buffer_len) == SWITCH_STATUS_SUCCESS) {
+                ivs_event_push_chunk_ready_zerocopy(IVS_EVENTSQ(ivs_session), &hdr, b64_buffer, b64_buffer_len);
+            } else {
+                switch_safe_free(b64_buffer);
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_b64_encode() fail\n");
+            }
+        } else if(hdr.encoding == IVS_CHUNK_ENCODING_WAV || hdr.encoding == IVS_CHUNK_ENCODING_MP3 || hdr.encoding == IVS_CHUNK_ENCODING_OPUS || hdr.encoding == IVS_CHUNK_ENCODING_FLAC) {
+            switch_byte_t *enc_buffer = NULL;
+            uint32_t enc_buffer_len = 0;
+
+            if(ivs_chunk_encode(hdr.encoding, data, data_len, hdr.samplerate, hdr.channels, &enc_buffer, &enc_buffer_len) == SWITCH_STATUS_SUCCESS) {
+                ivs_event_push_chunk_ready_zerocopy(IVS_EVENTSQ(ivs_session), &hdr, enc_buffer, enc_buffer_len);
+            } else {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to encode chunk (%s), dropped\n", ivs_chunkEncoding2name(hdr.encoding));
+            }
+        } else {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unsupported encoding type: %s\n", ivs_chunkEncoding2name(hdr.encoding));
+        }
+    }
+
+    switch_safe_free(compact_buffer);
+}
+
+/**
+ * stream mode: everything after the last emitted position plus some overlap.
+ * final chunks close the utterance and reset the buffer.
+ **/
+static void chunk_flush(ivs_session_t *ivs_session, uint32_t chunk_mode, uint8_t fl_final, uint8_t fl_eou) {
+    switch_buffer_t *chunk_buffer = ivs_session->chunk_buffer;
+    const void *ptr = NULL;
+    uint32_t buf_len = switch_buffer_peek_zerocopy(chunk_buffer, &ptr);
+    uint32_t offs = 0;
+
+    if(chunk_mode == IVS_CHUNK_MODE_STREAM && ivs_session->chunk_emit_offs > 0) {
+        uint32_t frame_bytes = (ivs_session->channels * sizeof(int16_t));
+        uint32_t overlap = ((globals.cfg_chunk_overlap_ms * ivs_session->chunk_rate) / 1000) * frame_bytes;
+
+        offs = (ivs_session->chunk_emit_offs > overlap ? ivs_session->chunk_emit_offs - overlap : 0);
+    }
+
+    if(buf_len > offs) {
+        chunk_emit(ivs_session, chunk_mode, (switch_byte_t *)ptr + offs, (buf_len - offs), fl_final, fl_eou);
+    }
+
+    if(fl_final) {
+        switch_buffer_zero(chunk_buffer);
+        ivs_session->chunk_emit_offs = 0;
+        ivs_session->chunk_seq = 0;
+        ivs_session->chunk_utterance++;
+    } else {
+        ivs_session->chunk_emit_offs = buf_len;
+    }
+}
+
+static inline uint32_t chunk_stream_bytes(ivs_session_t *ivs_session) {
+    return ((globals.cfg_chunk_stream_ms * ivs_session->chunk_rate) / 1000) * ivs_session->channels * sizeof(int16_t);
+}
+
+/**
+ * picks up ivs.chunkSamplerate and ivs.chunkLength, only between chunks (a chunk never mixes rates).
+ * the resampler keeps its filter state across frames.
+ **/
+static void chunk_params_update(ivs_session_t *ivs_session) {
+    uint32_t rate = 0, len_sec = 0;
+
+    switch_mutex_lock(ivs_session->mutex);
+    rate = (ivs_session->chunk_samplerate ? ivs_session->chunk_samplerate : ivs_session->samplerate);
+    len_sec = ivs_session->chunk_len_sec;
+    switch_mutex_unlock(ivs_session->mutex);
+
+    if(switch_buffer_inuse(ivs_session->chunk_buffer) > 0) {
+        return;
+    }
+
+    if(rate != ivs_session->chunk_rate) {
+        if(ivs_session->chunk_resampler) {
+            switch_resample_destroy(&ivs_session->chunk_resampler);
+        }
+        if(rate != ivs_session->samplerate) {
+            if(switch_resample_create(&ivs_session->chunk_resampler, ivs_session->samplerate, rate, ivs_session->decoded_bytes_per_packet, SWITCH_RESAMPLE_QUALITY, ivs_session->channels) != SWITCH_STATUS_SUCCESS) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to create resampler (%u => %u)\n", ivs_session->samplerate, rate);
+                ivs_session->chunk_resampler = NULL;
+                rate = ivs_session->samplerate;
+            }
+        }
+        ivs_session->chunk_rate = rate;
+    }
+
+    ivs_session->chunk_buffer_size = ((len_sec * ivs_session->chunk_rate) * ivs_session->channels * sizeof(int16_t));
+}
+
+/**
+ * called by a chunk worker, never concurrently for the same session.
+ * drains the captured frames into the chunk buffer and emits a chunk when it is full or at the end of an utterance,
+ * in stream mode also a partial one every chunk-stream-ms of new audio.
+ **/
+void ivs_chunks_process(ivs_session_t *ivs_session) {
+    switch_byte_t *au_data = NULL;
+    uint32_t au_data_len = 0, au_flags = 0;
+    uint32_t chunk_mode = 0, stream_bytes = 0;
+    uint8_t fl_chunk_ready = false;
+
+    if(globals.fl_shutdown || ivs_session->fl_do_destroy || ivs_session->fl_destroyed || !ivs_session->fl_ready) {
+        return;
+    }
+
+    switch_mutex_lock(ivs_session->mutex);
+    chunk_mode = ivs_session->chunk_mode;
+    switch_mutex_unlock(ivs_session->mutex);
+
+    chunk_params_update(ivs_session);
+
+    if(chunk_mode == IVS_CHUNK_MODE_STREAM) {
+        stream_bytes = chunk_stream_bytes(ivs_session);
+    }
+
+    while(audio_ring_peek(ivs_session->au_ring_out, &au_data, &au_data_len, &au_flags) == SWITCH_STATUS_SUCCESS) {
+        fl_chunk_ready = false;
+
+        if(au_data_len > 0) {
+            switch_audio_resampler_t *resampler = ivs_session->chunk_resampler;
+            uint32_t sz = 0;
+
+            if(resampler) {
+                switch_resample_process(resampler, (int16_t *)au_data, (au_data_len / (ivs_session->channels * sizeof(int16_t))));
+                sz = switch_buffer_write(ivs_session->chunk_buffer, resampler->to, (resampler->to_len * ivs_session->channels * sizeof(int16_t)));
+            } else {
+                sz = switch_buffer_write(ivs_session->chunk_buffer, au_data, au_data_len);
+            }
+            if(sz >= ivs_session->chunk_buffer_size) { fl_chunk_ready = true; }
+        }
+        if(au_flags & AUDIO_RING_FLAG_EOU) {
+            fl_chunk_ready = (switch_buffer_inuse(ivs_session->chunk_buffer) > 0);
+        }
+
+        audio_ring_release(ivs_session->au_ring_out);
+
+        if(fl_chunk_ready) {
+            chunk_flush(ivs_session, chunk_mode, true, ((au_flags & AUDIO_RING_FLAG_EOU) != 0));
+            chunk_params_update(ivs_session);
+            if(stream_bytes) { stream_bytes = chunk_stream_bytes(ivs_session); }
+        } else if(stream_bytes && (switch_buffer_inuse(ivs_session->chunk_buffer) - ivs_session->chunk_emit_offs) >= stream_bytes) {
+            chunk_flush(ivs_session, chunk_mode, false, false);
+        }
+    }
+
+    // the marker could have been lost on overrun
+    if(switch_buffer_inuse(ivs_session->chunk_buffer) > 0 && ivs_session->vad_state == SWITCH_VAD_STATE_STOP_TALKING) {
+        chunk_flush(ivs_session, chunk_mode, true, true);
+    }
+}
@@ -0,0 +1,13 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#ifndef IVS_CHUNKS_H
+#define IVS_CHUNKS_H
+
+#include <mod_ivs.h>
+
+void ivs_chunks_process(ivs_session_t *ivs_session);
+
+
+#endif
@@ -0,0 +1,195 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#include <ivs_cng.h>
+
+extern globals_t globals;
+
+/**
+ * pre-encoded comfort noise, one set per codec implementation, fmtp and level.
+ * sets are built once (with a private encoder instance and pool) and never change, so sessions share them without locking.
+ * a set is built outside of the mutex (it only guards the hash), the codecs that can't be encoded get a negative entry.
+ **/
+static switch_mutex_t *cng_mutex = NULL;
+static switch_hash_t *cng_sets = NULL;
+static ivs_cng_set_t cng_set_none = { 0 };
+
+static void cng_set_destroy(ivs_cng_set_t *set) {
+    switch_memory_pool_t *pool = NULL;
+
+    if(!set || set == &cng_set_none) { return; }
+
+    pool = set->pool;
+    switch_core_destroy_memory_pool(&pool);
+}
+
+static ivs_cng_set_t *cng_set_build(switch_codec_t *codec, uint32_t level) {
+    const switch_codec_implementation_t *impl = codec->implementation;
+    switch_memory_pool_t *cng_pool = NULL;
+    switch_codec_t enc_codec = { 0 };
+    ivs_cng_set_t *set = NULL;
+    int16_t *sln_buffer = NULL;
+    switch_byte_t *enc_buffer = NULL;
+    uint32_t sln_buffer_len = 0, enc_buffer_len = 0;
+    uint32_t enc_samplerate = 0, enc_flags = 0;
+    switch_status_t status = SWITCH_STATUS_FALSE;
+
+    if(switch_core_new_memory_pool(&cng_pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "pool fail\n");
+        return NULL;
+    }
+    if(switch_core_codec_init(&enc_codec, impl->iananame, NULL, codec->fmtp_in, impl->samples_per_second, (impl->microseconds_per_packet / 1000),
+                              impl->number_of_channels, SWITCH_CODEC_FLAG_ENCODE | SWITCH_CODEC_FLAG_DECODE, NULL, cng_pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to init codec: %s\n", impl->iananame);
+        switch_core_destroy_memory_pool(&cng_pool);
+        return NULL;
+    }
+
+    sln_buffer_len = (impl->samples_per_packet * impl->number_of_channels * sizeof(int16_t));
+    switch_malloc(sln_buffer, sln_buffer_len);
+    switch_malloc(enc_buffer, AUDIO_BUFFER_SIZE);
+
+    if((set = switch_core_alloc(cng_pool, sizeof(ivs_cng_set_t))) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        goto out;
+    }
+    set->pool = cng_pool;
+    set->samples = impl->samples_per_packet;
+
+    for(uint32_t i = 0; i < IVS_CNG_FRAMES; i++) {
+        switch_generate_sln_silence(sln_buffer, impl->samples_per_packet, impl->number_of_channels, level);
+
+        enc_flags = 0;
+        enc_samplerate = impl->samples_per_second;
+        enc_buffer_len = AUDIO_BUFFER_SIZE;
+
+        status = switch_core_codec_encode(&enc_codec, NULL, sln_buffer, sln_buffer_len, impl->samples_per_second, enc_buffer, &enc_buffer_len, &enc_samplerate, &enc_flags);
+        if(status != SWITCH_STATUS_SUCCESS || enc_buffer_len == 0) {
+            continue;
+        }
+        if((set->frame_data[set->frames] = switch_core_alloc(cng_pool, enc_buffer_len)) == NULL) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+            break;
+        }
+        memcpy(set->frame_data[set->frames], enc_buffer, enc_buffer_len);
+        set->frame_len[set->frames] = enc_buffer_len;
+        set->frames++;
+    }
+
+    if(!set->frames) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to encode cng frames (%s)\n", impl->iananame);
+        set = NULL;
+    }
+out:
+    switch_core_codec_destroy(&enc_codec);
+    switch_safe_free(sln_buffer);
+    switch_safe_free(enc_buffer);
+    if(!set) {
+        switch_core_destroy_memory_pool(&cng_pool);
+    }
+    return set;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// public
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+switch_status_t ivs_cng_init(switch_memory_pool_t *pool) {
+    switch_assert(pool);
+
+    switch_mutex_init(&cng_mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_core_hash_init(&cng_sets);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void ivs_cng_shutdown() {
+    switch_hash_index_t *hi = NULL;
+    void *hval = NULL;
+
+    if(!cng_sets) { return; }
+
+    switch_mutex_lock(cng_mutex);
+    for(hi = switch_core_hash_first_iter(cng_sets, hi); hi; hi = switch_core_hash_next(&hi)) {
+        switch_core_hash_this(hi, NULL, NULL, &hval);
+        cng_set_destroy((ivs_cng_set_t *)hval);
+    }
+    switch_safe_free(hi);
+    switch_core_hash_destroy(&cng_sets);
+    switch_mutex_unlock(cng_mutex);
+}
+
+ivs_cng_set_t *ivs_cng_lookup(switch_codec_t *codec, uint32_t level) {
+    const switch_codec_implementation_t *impl = NULL;
+    ivs_cng_set_t *set = NULL, *set_new = NULL;
+    char *key = NULL;
+
+    if(!cng_sets || !level || !codec || !switch_core_codec_ready(codec)) {
+        return NULL;
+    }
+
+    // fmtp changes the encoder (opus / g729 annexes, ...)
+    impl = codec->implementation;
+    key = switch_mprintf("%s/%u/%u/%u/%u/%s", impl->iananame, impl->samples_per_second, impl->microseconds_per_packet, impl->number_of_channels, level,
+                         (codec->fmtp_in ? codec->fmtp_in : ""));
+    if(!key) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        return NULL;
+    }
+
+    switch_mutex_lock(cng_mutex);
+    set = switch_core_hash_find(cng_sets, key);
+    switch_mutex_unlock(cng_mutex);
+
+    if(set == NULL) {
+        set_new = cng_set_build(codec, level);
+
+        // somebody could build the same one meanwhile, the first one stays
+        switch_mutex_lock(cng_mutex);
+        if((set = switch_core_hash_find(cng_sets, key)) == NULL) {
+            set = (set_new ? set_new : &cng_set_none);
+            switch_core_hash_insert(cng_sets, key, set);
+            if(set_new) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "CNG set created: %s (frames=%u)\n", key, set_new->frames);
+            } else {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "CNG set unavailable: %s (the session codec will be used)\n", key);
+            }
+            set_new = NULL;
+        }
+        switch_mutex_unlock(cng_mutex);
+
+        cng_set_destroy(set_new);
+    }
+
+    switch_safe_free(key);
+    return (set == &cng_set_none ? NULL : set);
+}
+
+/**
+ * non-cached path (no set for the codec): one fresh frame encoded by the session codec,
+ * returns the encoded length (0 on failure), buffers should be AUDIO_BUFFER_SIZE
+ **/
+uint32_t ivs_cng_encode(switch_codec_t *codec, uint32_t level, int16_t *sln_buffer, switch_byte_t *enc_buffer) {
+    const switch_codec_implementation_t *impl = NULL;
+    uint32_t sln_buffer_len = 0, enc_buffer_len = AUDIO_BUFFER_SIZE;
+    uint32_t enc_samplerate = 0, enc_flags = 0;
+
+    if(!level || !codec || !switch_core_codec_ready(codec)) {
+        return 0;
+    }
+
+    impl = codec->implementation;
+    sln_buffer_len = (impl->samples_per_packet * impl->number_of_channels * sizeof(int16_t));
+    if(sln_buffer_len > AUDIO_BUFFER_SIZE) {
+        return 0;
+    }
+
+    switch_generate_sln_silence(sln_buffer, impl->samples_per_packet, impl->number_of_channels, level);
+
+    enc_samplerate = impl->samples_per_second;
+    if(switch_core_codec_encode(codec, NULL, sln_buffer, sln_buffer_len, impl->samples_per_second, enc_buffer, &enc_buffer_len, &enc_samplerate, &enc_flags) != SWITCH_STATUS_SUCCESS) {
+        return 0;
+    }
+
+    return enc_buffer_len;
+}
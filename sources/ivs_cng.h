@@ -0,0 +1,26 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#ifndef IVS_CNG_H
+#define IVS_CNG_H
+
+#include <mod_ivs.h>
+
+#define IVS_CNG_FRAMES                  32
+
+typedef struct {
+    switch_memory_pool_t    *pool;
+    uint32_t                frames;
+    uint32_t                samples;    // per frame
+    uint32_t                frame_len[IVS_CNG_FRAMES];
+    switch_byte_t           *frame_data[IVS_CNG_FRAMES];
+} ivs_cng_set_t;
+
+switch_status_t ivs_cng_init(switch_memory_pool_t *pool);
+void ivs_cng_shutdown();
+ivs_cng_set_t *ivs_cng_lookup(switch_codec_t *codec, uint32_t level);
+uint32_t ivs_cng_encode(switch_codec_t *codec, uint32_t level, int16_t *sln_buffer, switch_byte_t *enc_buffer);
+
+
+#endif
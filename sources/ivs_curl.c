@@ -3,6 +3,7 @@
  * https://github.com/akscf/
  **/
 #include <ivs_curl.h>
+#include <ivs_chunk_store.h>
 
 extern globals_t globals;
 
@@ -124,7 +125,11 @@ switch_status_t curl_perform(curl_conf_t *curl_config) {
                 if(field_conf->type == CURL_FIELD_TYPE_SIMPLE)  {
                     if(field_conf->value) { curl_mime_data(field, field_conf->value, CURL_ZERO_TERMINATED); }
                 } else if(field_conf->type == CURL_FIELD_TYPE_FILE)  {
-                    if(field_conf->value) { curl_mime_filedata(field, field_conf->value); }
+                    if(field_conf->value) { curl_mime_filedata(field, (field_conf->file_path ? field_conf->file_path : field_conf->value)); }
+                    if(field_conf->file_name) { curl_mime_filename(field, field_conf->file_name); }
+                } else if(field_conf->type == CURL_FIELD_TYPE_BUFFER)  {
+                    if(field_conf->data) { curl_mime_data(field, (char *)field_conf->data, field_conf->data_len); }
+                    if(field_conf->value) { curl_mime_filename(field, field_conf->value); }
                 }
             }
             field_conf = (xcurl_from_field_t *)field_conf->next;
@@ -171,6 +176,10 @@ switch_status_t curl_field_add(curl_conf_t *curl_config, int type, char *name, c
     field_conf->name = (name ? switch_core_strdup(curl_config->pool, name) : NULL);
     field_conf->value = (value ? switch_core_strdup(curl_config->pool, value) : NULL);
 
+    if(type == CURL_FIELD_TYPE_FILE) {
+        ivs_chunk_store_take(curl_config->session_id, field_conf->value, curl_config->pool, &field_conf->file_name, &field_conf->file_path);
+    }
+
     if(curl_config->fields == NULL) {
         curl_config->fields = field_conf;
         curl_config->fields_tail = field_conf;
@@ -182,6 +191,24 @@ switch_status_t curl_field_add(curl_conf_t *curl_config, int type, char *name, c
     return SWITCH_STATUS_SUCCESS;
 }
 
+switch_status_t curl_field_add_buffer(curl_conf_t *curl_config, char *name, char *file_name, switch_byte_t *data, uint32_t data_len) {
+    xcurl_from_field_t *field_conf = NULL;
+
+    if(curl_field_add(curl_config, CURL_FIELD_TYPE_BUFFER, name, file_name) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    field_conf = curl_config->fields_tail;
+    if(data && data_len > 0) {
+        if((field_conf->data = safe_pool_bufdup(curl_config->pool, data, data_len)) == NULL) {
+            return SWITCH_STATUS_FALSE;
+        }
+        field_conf->data_len = data_len;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
 switch_status_t curl_config_alloc(curl_conf_t **curl_config, switch_memory_pool_t *pool, uint8_t with_recvbuff) {
     switch_status_t status = SWITCH_STATUS_SUCCESS;
     switch_memory_pool_t *lpool = pool;
@@ -237,6 +264,14 @@ void curl_config_free(curl_conf_t *curl_config) {
     switch_memory_pool_t *pool = (curl_config ? curl_config->pool : NULL);
 
     if(curl_config) {
+        xcurl_from_field_t *field_conf = curl_config->fields;
+
+        while(field_conf) {
+            if(field_conf->type == CURL_FIELD_TYPE_FILE && field_conf->file_name) {
+                ivs_chunk_store_done(curl_config->session_id, field_conf->value);
+            }
+            field_conf = (xcurl_from_field_t *)field_conf->next;
+        }
         if(curl_config->recv_buffer) {
             switch_buffer_destroy(&curl_config->recv_buffer);
         }
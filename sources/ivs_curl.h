@@ -9,6 +9,7 @@
 
 #define CURL_FIELD_TYPE_SIMPLE  0
 #define CURL_FIELD_TYPE_FILE    1
+#define CURL_FIELD_TYPE_BUFFER  2 // in-memory file, value = file name
 
 #define CURL_METHOD_GET         0
 #define CURL_METHOD_PUT         1
@@ -19,11 +20,16 @@ typedef struct {
     int             type;
     char            *name;
     char            *value;
+    char            *file_name; // chunk store files (held until curl_config_free)
+    const char      *file_path; // chunk store files: path to open (memfd)
+    switch_byte_t   *data;
+    uint32_t        data_len;
     void            *next;
 } xcurl_from_field_t;
 
 typedef struct {
     switch_memory_pool_t    *pool;
+    const char              *session_id;    // chunk store files are looked up in this session
     xcurl_from_field_t      *fields;
     xcurl_from_field_t      *fields_tail;
     char                    *url;
@@ -53,6 +59,7 @@ void curl_config_free(curl_conf_t *curl_config);
 switch_status_t curl_config_alloc(curl_conf_t **curl_config, switch_memory_pool_t *pool, uint8_t with_recvbuff);
 switch_status_t curl_perform(curl_conf_t *curl_config);
 switch_status_t curl_field_add(curl_conf_t *curl_config, int type, char *name, char *value);
+switch_status_t curl_field_add_buffer(curl_conf_t *curl_config, char *name, char *file_name, switch_byte_t *data, uint32_t data_len);
 uint32_t curl_method2id(const char *name);
 const char *curl_method2name(uint32_t id);
 
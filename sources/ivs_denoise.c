@@ -0,0 +1,208 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#include <ivs_denoise.h>
+#include <math.h>
+#include <time.h>
+
+extern globals_t globals;
+
+/**
+ * spectral subtraction (mono, cpu only).
+ * sqrt-hann windows with 50% overlap, noise power tracked per bin (averaged in noise, frozen-ish in speech),
+ * over-subtracted gains with a floor and time smoothing to keep the musical noise down.
+ * adds N/2 samples of latency.
+ **/
+#define DN_OVERSUB          2.0f
+#define DN_GAIN_FLOOR       0.1f    // -20dB
+#define DN_GAIN_SMOOTH      0.5f
+#define DN_NOISE_ALPHA      0.90f   // recursive averaging while the bin looks like noise
+#define DN_NOISE_SPEECH     4.0f    // P > noise * N: bin is taken as speech
+#define DN_NOISE_UP         1.003f  // ...and the estimate only creeps up
+#define DN_INIT_BLOCKS      8       // noise estimate is learned from the first blocks
+
+static inline uint64_t dn_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void fft(ivs_denoise_t *dn, float *re, float *im, uint8_t inverse) {
+    uint32_t n = dn->fft_size;
+
+    for(uint32_t i = 1, j = 0; i < n; i++) {
+        uint32_t bit = (n >> 1);
+        for(; j & bit; bit >>= 1) { j ^= bit; }
+        j ^= bit;
+        if(i < j) {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    for(uint32_t len = 2; len <= n; len <<= 1) {
+        uint32_t half = (len >> 1), step = (n / len);
+        for(uint32_t i = 0; i < n; i += len) {
+            for(uint32_t k = 0; k < half; k++) {
+                float wr = dn->twiddle_re[k * step];
+                float wi = (inverse ? -dn->twiddle_im[k * step] : dn->twiddle_im[k * step]);
+                float xr = re[i + k + half] * wr - im[i + k + half] * wi;
+                float xi = re[i + k + half] * wi + im[i + k + half] * wr;
+                re[i + k + half] = re[i + k] - xr;
+                im[i + k + half] = im[i + k] - xi;
+                re[i + k] += xr;
+                im[i + k] += xi;
+            }
+        }
+    }
+
+    if(inverse) {
+        for(uint32_t i = 0; i < n; i++) { re[i] /= n; im[i] /= n; }
+    }
+}
+
+static void denoise_block(ivs_denoise_t *dn) {
+    uint32_t n = dn->fft_size, bins = (n / 2) + 1;
+
+    for(uint32_t i = 0; i < n; i++) {
+        dn->re[i] = dn->in_hist[i] * dn->window[i];
+        dn->im[i] = 0;
+    }
+
+    fft(dn, dn->re, dn->im, false);
+
+    for(uint32_t k = 0; k < bins; k++) {
+        float p = (dn->re[k] * dn->re[k]) + (dn->im[k] * dn->im[k]);
+        float g = 0;
+
+        if(dn->blocks < DN_INIT_BLOCKS) {
+            dn->noise[k] = (dn->blocks == 0 ? p : dn->noise[k] + (p - dn->noise[k]) / (dn->blocks + 1));
+        } else if(p < (dn->noise[k] * DN_NOISE_SPEECH)) {
+            dn->noise[k] = (DN_NOISE_ALPHA * dn->noise[k]) + ((1.0f - DN_NOISE_ALPHA) * p);
+        } else {
+            dn->noise[k] *= DN_NOISE_UP;
+        }
+
+        g = (p > 0 ? 1.0f - (DN_OVERSUB * dn->noise[k] / p) : 0);
+        g = MAX(g, DN_GAIN_FLOOR);
+        g = (DN_GAIN_SMOOTH * dn->gain[k]) + ((1.0f - DN_GAIN_SMOOTH) * g);
+        dn->gain[k] = g;
+
+        dn->re[k] *= g; dn->im[k] *= g;
+        if(k > 0 && k < n / 2) {
+            dn->re[n - k] *= g; dn->im[n - k] *= g;
+        }
+    }
+
+    fft(dn, dn->re, dn->im, true);
+
+    // overlap-add, first half goes out
+    for(uint32_t i = 0; i < dn->hop; i++) {
+        float v = dn->ola[i] + (dn->re[i] * dn->window[i]);
+        int32_t s = (int32_t)lrintf(v);
+
+        dn->out_fifo[dn->out_fifo_len++] = (s > 32767 ? 32767 : (s < -32768 ? -32768 : s));
+        dn->ola[i] = dn->re[i + dn->hop] * dn->window[i + dn->hop];
+    }
+
+    dn->blocks++;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// public
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+switch_status_t ivs_denoise_create(ivs_denoise_t **dn, uint32_t samplerate, uint32_t frame_samples, switch_memory_pool_t *pool) {
+    ivs_denoise_t *ldn = NULL;
+    uint32_t n = 256;
+
+    switch_assert(pool);
+
+    // ~32ms blocks
+    while(n < (samplerate * 32 / 1000)) { n <<= 1; }
+
+    if((ldn = switch_core_alloc(pool, sizeof(ivs_denoise_t))) == NULL) {
+        goto mem_fail;
+    }
+
+    ldn->samplerate = samplerate;
+    ldn->fft_size = n;
+    ldn->hop = (n / 2);
+    ldn->fifo_size = (ldn->hop + frame_samples) * 2;
+
+    if((ldn->window = switch_core_alloc(pool, n * sizeof(float))) == NULL) { goto mem_fail; }
+    if((ldn->twiddle_re = switch_core_alloc(pool, (n / 2) * sizeof(float))) == NULL) { goto mem_fail; }
+    if((ldn->twiddle_im = switch_core_alloc(pool, (n / 2) * sizeof(float))) == NULL) { goto mem_fail; }
+    if((ldn->re = switch_core_alloc(pool, n * sizeof(float))) == NULL) { goto mem_fail; }
+    if((ldn->im = switch_core_alloc(pool, n * sizeof(float))) == NULL) { goto mem_fail; }
+    if((ldn->in_hist = switch_core_alloc(pool, n * sizeof(float))) == NULL) { goto mem_fail; }
+    if((ldn->ola = switch_core_alloc(pool, ldn->hop * sizeof(float))) == NULL) { goto mem_fail; }
+    if((ldn->noise = switch_core_alloc(pool, ((n / 2) + 1) * sizeof(float))) == NULL) { goto mem_fail; }
+    if((ldn->gain = switch_core_alloc(pool, ((n / 2) + 1) * sizeof(float))) == NULL) { goto mem_fail; }
+    if((ldn->in_fifo = switch_core_alloc(pool, ldn->fifo_size * sizeof(int16_t))) == NULL) { goto mem_fail; }
+    if((ldn->out_fifo = switch_core_alloc(pool, ldn->fifo_size * sizeof(int16_t))) == NULL) { goto mem_fail; }
+
+    for(uint32_t i = 0; i < n; i++) {
+        ldn->window[i] = sqrtf(0.5f * (1.0f - cosf((2.0f * M_PI * i) / n)));
+    }
+    for(uint32_t i = 0; i < n / 2; i++) {
+        ldn->twiddle_re[i] = cosf((2.0f * M_PI * i) / n);
+        ldn->twiddle_im[i] = -sinf((2.0f * M_PI * i) / n);
+    }
+    for(uint32_t i = 0; i <= n / 2; i++) {
+        ldn->gain[i] = 1.0f;
+    }
+
+    // latency: start with one hop of silence
+    ldn->out_fifo_len = ldn->hop;
+
+    *dn = ldn;
+    return SWITCH_STATUS_SUCCESS;
+
+mem_fail:
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+    return SWITCH_STATUS_MEMERR;
+}
+
+/**
+ * in place, mono L16
+ **/
+void ivs_denoise_process(ivs_denoise_t *dn, int16_t *data, uint32_t samples) {
+    uint64_t ts = dn_now_ns(), te = 0;
+
+    if(samples > dn->fifo_size - dn->in_fifo_len) {
+        return;
+    }
+
+    memcpy(dn->in_fifo + dn->in_fifo_len, data, samples * sizeof(int16_t));
+    dn->in_fifo_len += samples;
+
+    while(dn->in_fifo_len >= dn->hop) {
+        memmove(dn->in_hist, dn->in_hist + dn->hop, dn->hop * sizeof(float));
+        for(uint32_t i = 0; i < dn->hop; i++) {
+            dn->in_hist[dn->hop + i] = dn->in_fifo[i];
+        }
+        dn->in_fifo_len -= dn->hop;
+        memmove(dn->in_fifo, dn->in_fifo + dn->hop, dn->in_fifo_len * sizeof(int16_t));
+
+        denoise_block(dn);
+    }
+
+    if(dn->out_fifo_len >= samples) {
+        memcpy(data, dn->out_fifo, samples * sizeof(int16_t));
+        dn->out_fifo_len -= samples;
+        memmove(dn->out_fifo, dn->out_fifo + samples, dn->out_fifo_len * sizeof(int16_t));
+    }
+
+    te = dn_now_ns() - ts;
+    dn->frames++;
+    dn->cost_ns += te;
+    if(te > dn->cost_max_ns) { dn->cost_max_ns = te; }
+}
+
+void ivs_denoise_stats(ivs_denoise_t *dn, switch_stream_handle_t *stream) {
+    if(!dn) { return; }
+
+    stream->write_function(stream, "denoise: fft=%u, frames=%"SWITCH_UINT64_T_FMT"\n", dn->fft_size, dn->frames);
+    stream->write_function(stream, "denoise-cost-ns: avg=%"SWITCH_UINT64_T_FMT", max=%"SWITCH_UINT64_T_FMT"\n", (dn->frames ? dn->cost_ns / dn->frames : 0), dn->cost_max_ns);
+}
@@ -0,0 +1,40 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#ifndef IVS_DENOISE_H
+#define IVS_DENOISE_H
+
+#include <mod_ivs.h>
+
+struct ivs_denoise_s {
+    uint32_t                samplerate;
+    uint32_t                fft_size;       // N, hop = N/2
+    uint32_t                hop;
+    float                   *window;        // sqrt-hann (analysis + synthesis)
+    float                   *twiddle_re;
+    float                   *twiddle_im;
+    float                   *re;
+    float                   *im;
+    float                   *in_hist;       // last N input samples
+    float                   *ola;           // overlap-add tail (hop)
+    float                   *noise;         // noise power estimate (N/2 + 1)
+    float                   *gain;          // smoothed gains (N/2 + 1)
+    int16_t                 *in_fifo;
+    int16_t                 *out_fifo;
+    uint32_t                in_fifo_len;
+    uint32_t                out_fifo_len;
+    uint32_t                fifo_size;
+    uint32_t                blocks;
+    // cost counters
+    uint64_t                frames;
+    uint64_t                cost_ns;
+    uint64_t                cost_max_ns;
+};
+
+switch_status_t ivs_denoise_create(ivs_denoise_t **dn, uint32_t samplerate, uint32_t frame_samples, switch_memory_pool_t *pool);
+void ivs_denoise_process(ivs_denoise_t *dn, int16_t *data, uint32_t samples);
+void ivs_denoise_stats(ivs_denoise_t *dn, switch_stream_handle_t *stream);
+
+
+#endif
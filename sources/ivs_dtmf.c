@@ -0,0 +1,93 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#include <ivs_dtmf.h>
+#include <ivs_events.h>
+
+extern globals_t globals;
+
+/* must be called under the session mutex */
+static void collect_finish(ivs_session_t *ivs_session, uint32_t reason) {
+    ivs_dtmf_collector_t *collector = &ivs_session->dtmf_collector;
+
+    collector->fl_active = false;
+    ivs_event_push_dtmf_collected(IVS_EVENTSQ(ivs_session), collector->digits, reason);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// public
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+/**
+ * digits come from the playback input callback while a prompt is playing, from the media loop otherwise
+ **/
+void ivs_dtmf_process(ivs_session_t *ivs_session, switch_dtmf_t *dtmf) {
+    ivs_dtmf_collector_t *collector = &ivs_session->dtmf_collector;
+
+    // duration is in samples (8kHz)
+    ivs_event_push_dtmf(IVS_EVENTSQ(ivs_session), dtmf->digit, (dtmf->duration / 8));
+
+    switch_mutex_lock(ivs_session->mutex);
+    if(collector->fl_active) {
+        collector->last_ts = switch_micro_time_now();
+
+        if(!zstr(collector->terminators) && strchr(collector->terminators, dtmf->digit)) {
+            collect_finish(ivs_session, IVS_DTMF_COLLECT_TERMINATOR);
+        } else {
+            if(collector->digits_len < IVS_DTMF_DIGITS_MAX) {
+                collector->digits[collector->digits_len++] = dtmf->digit;
+                collector->digits[collector->digits_len] = '\0';
+            }
+            if(collector->digits_len >= collector->digits_max) {
+                collect_finish(ivs_session, IVS_DTMF_COLLECT_MAX_DIGITS);
+            }
+        }
+    }
+    switch_mutex_unlock(ivs_session->mutex);
+}
+
+/**
+ * replaces the one in progress (if any), ends up with a dtmf-collected event
+ **/
+void ivs_dtmf_collect_start(ivs_session_t *ivs_session, uint32_t digits_max, const char *terminators, uint32_t timeout_ms) {
+    ivs_dtmf_collector_t *collector = &ivs_session->dtmf_collector;
+
+    switch_mutex_lock(ivs_session->mutex);
+    if(collector->fl_active) {
+        collect_finish(ivs_session, IVS_DTMF_COLLECT_CANCELED);
+    }
+    memset(collector, 0, sizeof(ivs_dtmf_collector_t));
+    if(terminators) {
+        switch_copy_string(collector->terminators, terminators, sizeof(collector->terminators));
+    }
+    collector->digits_max = ((digits_max && digits_max <= IVS_DTMF_DIGITS_MAX) ? digits_max : IVS_DTMF_DIGITS_MAX);
+    collector->timeout_ms = timeout_ms;
+    collector->last_ts = switch_micro_time_now();
+    collector->fl_active = true;
+    switch_mutex_unlock(ivs_session->mutex);
+}
+
+void ivs_dtmf_collect_cancel(ivs_session_t *ivs_session) {
+    switch_mutex_lock(ivs_session->mutex);
+    if(ivs_session->dtmf_collector.fl_active) {
+        collect_finish(ivs_session, IVS_DTMF_COLLECT_CANCELED);
+    }
+    switch_mutex_unlock(ivs_session->mutex);
+}
+
+/**
+ * media loop, every frame
+ **/
+void ivs_dtmf_collect_timer(ivs_session_t *ivs_session) {
+    ivs_dtmf_collector_t *collector = &ivs_session->dtmf_collector;
+
+    if(!collector->fl_active || !collector->timeout_ms) {
+        return;
+    }
+
+    switch_mutex_lock(ivs_session->mutex);
+    if(collector->fl_active && collector->timeout_ms && (switch_micro_time_now() - collector->last_ts) >= (collector->timeout_ms * 1000)) {
+        collect_finish(ivs_session, IVS_DTMF_COLLECT_TIMEOUT);
+    }
+    switch_mutex_unlock(ivs_session->mutex);
+}
@@ -0,0 +1,16 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#ifndef IVS_DTMF_H
+#define IVS_DTMF_H
+
+#include <mod_ivs.h>
+
+void ivs_dtmf_process(ivs_session_t *ivs_session, switch_dtmf_t *dtmf);
+void ivs_dtmf_collect_start(ivs_session_t *ivs_session, uint32_t digits_max, const char *terminators, uint32_t timeout_ms);
+void ivs_dtmf_collect_cancel(ivs_session_t *ivs_session);
+void ivs_dtmf_collect_timer(ivs_session_t *ivs_session);
+
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#include <ivs_echo.h>
+#include <math.h>
+
+extern globals_t globals;
+
+/**
+ * playback echo gate.
+ * the power of every frame we write (tts, files) is kept for tail-ms, a captured frame is treated as echo
+ * when its power is below the loudest recent reference attenuated by erl-db (caller talking over the prompt is louder than that).
+ * echo frames are zeroed before vad, so they neither trigger it nor end up in the chunks.
+ **/
+static double frame_power(int16_t *data, uint32_t samples) {
+    int64_t acc = 0;
+
+    if(!samples) { return 0; }
+
+    for(uint32_t i = 0; i < samples; i++) {
+        acc += (int32_t)data[i] * data[i];
+    }
+    return ((double)acc / samples);
+}
+
+static switch_bool_t echo_ref_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type) {
+    ivs_echo_gate_t *gate = (ivs_echo_gate_t *)user_data;
+
+    if(type == SWITCH_ABC_TYPE_WRITE_REPLACE) {
+        switch_frame_t *frame = switch_core_media_bug_get_write_replace_frame(bug);
+
+        if(frame && frame->datalen > 0) {
+            uint32_t idx = (__atomic_load_n(&gate->ref_head, __ATOMIC_RELAXED) % IVS_ECHO_REF_FRAMES);
+
+            gate->ref_power[idx] = frame_power((int16_t *)frame->data, (frame->datalen / sizeof(int16_t)));
+            gate->ref_ts[idx] = switch_micro_time_now();
+            __atomic_add_fetch(&gate->ref_head, 1, __ATOMIC_RELEASE);
+        }
+
+        switch_core_media_bug_set_write_replace_frame(bug, frame);
+    }
+
+    return SWITCH_TRUE;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// public
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+switch_status_t ivs_echo_gate_create(ivs_echo_gate_t **gate, switch_core_session_t *session, uint32_t tail_ms, uint32_t erl_db, switch_memory_pool_t *pool) {
+    ivs_echo_gate_t *gate_local = NULL;
+
+    if((gate_local = switch_core_alloc(pool, sizeof(ivs_echo_gate_t))) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        return SWITCH_STATUS_MEMERR;
+    }
+
+    gate_local->tail_ms = tail_ms;
+    gate_local->erl = pow(10.0, -((double)erl_db / 10.0));
+
+    if(switch_core_media_bug_add(session, "ivs_echo_ref", NULL, echo_ref_callback, gate_local, 0, (SMBF_WRITE_REPLACE | SMBF_NO_PAUSE), &gate_local->bug) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to add media bug\n");
+        return SWITCH_STATUS_FALSE;
+    }
+
+    *gate = gate_local;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void ivs_echo_gate_destroy(ivs_echo_gate_t **gate, switch_core_session_t *session) {
+    if(gate && *gate) {
+        if((*gate)->bug) {
+            switch_core_media_bug_remove(session, &(*gate)->bug);
+        }
+        *gate = NULL;
+    }
+}
+
+/**
+ * returns true if the frame was taken for echo (and muted)
+ **/
+uint8_t ivs_echo_gate_process(ivs_echo_gate_t *gate, int16_t *data, uint32_t samples) {
+    switch_time_t since = switch_micro_time_now() - (gate->tail_ms * 1000);
+    uint32_t head = __atomic_load_n(&gate->ref_head, __ATOMIC_ACQUIRE);
+    uint32_t n = MIN(head, IVS_ECHO_REF_FRAMES);
+    double ref_max = 0, power = 0;
+
+    gate->frames++;
+
+    for(uint32_t i = 0; i < n; i++) {
+        uint32_t idx = ((head - 1 - i) % IVS_ECHO_REF_FRAMES);
+        if(gate->ref_ts[idx] < since) { break; }
+        if(gate->ref_power[idx] > ref_max) { ref_max = gate->ref_power[idx]; }
+    }
+
+    if(ref_max <= 0) {
+        return false;
+    }
+
+    power = frame_power(data, samples);
+    if(power > (ref_max * gate->erl)) {
+        return false; // double talk
+    }
+
+    memset(data, 0, samples * sizeof(int16_t));
+    gate->suppressed_frames++;
+
+    return true;
+}
+
+void ivs_echo_gate_stats(ivs_echo_gate_t *gate, switch_stream_handle_t *stream) {
+    if(!gate) { return; }
+
+    stream->write_function(stream, "echo-gate: tail=%ums, frames=%"SWITCH_UINT64_T_FMT", suppressed=%"SWITCH_UINT64_T_FMT"\n", gate->tail_ms, gate->frames, gate->suppressed_frames);
+}
@@ -0,0 +1,31 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#ifndef IVS_ECHO_H
+#define IVS_ECHO_H
+
+#include <mod_ivs.h>
+
+#define IVS_ECHO_REF_FRAMES             64      // reference history (frames)
+
+struct ivs_echo_gate_s {
+    switch_media_bug_t      *bug;
+    uint32_t                tail_ms;
+    double                  erl;            // linear (power), from erl-db
+    // reference (written by the playback thread)
+    double                  ref_power[IVS_ECHO_REF_FRAMES];
+    switch_time_t           ref_ts[IVS_ECHO_REF_FRAMES];
+    uint32_t                ref_head;
+    // counters
+    uint64_t                frames;
+    uint64_t                suppressed_frames;
+};
+
+switch_status_t ivs_echo_gate_create(ivs_echo_gate_t **gate, switch_core_session_t *session, uint32_t tail_ms, uint32_t erl_db, switch_memory_pool_t *pool);
+void ivs_echo_gate_destroy(ivs_echo_gate_t **gate, switch_core_session_t *session);
+uint8_t ivs_echo_gate_process(ivs_echo_gate_t *gate, int16_t *data, uint32_t samples);
+void ivs_echo_gate_stats(ivs_echo_gate_t *gate, switch_stream_handle_t *stream);
+
+
+#endif
@@ -0,0 +1,175 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#include <ivs_endpoint.h>
+#include <math.h>
+
+extern globals_t globals;
+
+#define EP_LONG_UTTERANCE_MS        2000
+#define EP_FALLING_RATIO            0.35    // tail energy vs utterance average (~-4.5dB)
+#define EP_SHORTEN                  0.70
+#define EP_SHORT_ANSWER             0.50
+#define EP_LENGTHEN                 1.50
+#define EP_TAIL_MS                  200
+#define EP_SNR_FACTOR               2.5
+#define EP_NF_RISE                  0.005
+#define EP_NF_FALL                  0.100
+#define EP_NF_MIN                   8.0
+
+/**
+ * picks the hangover for the pause that has just started
+ **/
+static void pause_started(ivs_endpoint_t *ep) {
+    double timeout = ep->base_ms;
+    uint32_t max_ms = ivs_endpoint_max_ms(ep);
+
+    ep->reasons = 0;
+
+    if(ep->fl_short_answer) {
+        timeout *= EP_SHORT_ANSWER;
+        ep->reasons |= IVS_EP_REASON_SHORT_ANSWER;
+    }
+    if(ep->speech_ms >= EP_LONG_UTTERANCE_MS) {
+        timeout *= EP_SHORTEN;
+        ep->reasons |= IVS_EP_REASON_LONG;
+    }
+    if(ep->energy_avg > 0 && ep->energy_tail < (ep->energy_avg * EP_FALLING_RATIO)) {
+        timeout *= EP_SHORTEN;
+        ep->reasons |= IVS_EP_REASON_FALLING;
+    } else if(ep->energy_avg > 0 && ep->energy_tail >= ep->energy_avg && !ep->fl_short_answer) {
+        timeout *= EP_LENGTHEN;
+        ep->reasons |= IVS_EP_REASON_MID_SENTENCE;
+    }
+
+    ep->timeout_ms = (uint32_t)timeout;
+    if(ep->timeout_ms < IVS_EP_MIN_MS) { ep->timeout_ms = IVS_EP_MIN_MS; }
+    if(ep->timeout_ms > max_ms) { ep->timeout_ms = max_ms; }
+}
+
+static void utterance_reset(ivs_endpoint_t *ep) {
+    ep->fl_talking = false;
+    ep->fl_in_silence = false;
+    ep->speech_ms = 0;
+    ep->silence_ms = 0;
+    ep->timeout_ms = 0;
+    ep->reasons = 0;
+    ep->voiced_frames = 0;
+    ep->energy_avg = 0;
+    ep->energy_tail = 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// public
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+switch_status_t ivs_endpoint_create(ivs_endpoint_t **ep, uint32_t samplerate, uint32_t channels, switch_memory_pool_t *pool) {
+    ivs_endpoint_t *lep = NULL;
+
+    switch_assert(pool);
+
+    if((lep = switch_core_alloc(pool, sizeof(ivs_endpoint_t))) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        return SWITCH_STATUS_MEMERR;
+    }
+
+    lep->samplerate = samplerate;
+    lep->channels = channels;
+    lep->base_ms = IVS_EP_BASE_MS;
+    lep->noise_floor = EP_NF_MIN;
+
+    *ep = lep;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void ivs_endpoint_set_params(ivs_endpoint_t *ep, uint32_t base_ms, uint32_t thresh, uint8_t fl_short_answer) {
+    switch_assert(ep);
+
+    ep->base_ms = (base_ms ? base_ms : IVS_EP_BASE_MS);
+    ep->thresh = thresh;
+    ep->fl_short_answer = fl_short_answer;
+}
+
+/**
+ * the vad hangover should be set to this, the endpointer cuts the pauses itself
+ **/
+uint32_t ivs_endpoint_max_ms(ivs_endpoint_t *ep) {
+    return (ep->base_ms * IVS_EP_MAX_FACTOR);
+}
+
+/**
+ * follows the vad and turns TALKING into STOP_TALKING once the pause is longer than the adaptive hangover.
+ * decision (optional) is filled in when the utterance ends.
+ **/
+switch_vad_state_t ivs_endpoint_process(ivs_endpoint_t *ep, switch_vad_state_t vad_state, int16_t *data, uint32_t samples, ivs_endpoint_decision_t *decision) {
+    uint32_t frame_ms = 0;
+    double energy = 0, rms = 0, level = 0, k = 0;
+    uint8_t fl_speech = false;
+
+    if(!samples) {
+        return vad_state;
+    }
+
+    for(uint32_t i = 0; i < samples; i++) {
+        energy += ((double)data[i] * data[i]);
+    }
+    energy /= samples;
+    rms = sqrt(energy);
+    frame_ms = (samples * 1000) / (ep->samplerate * ep->channels);
+
+    level = MAX((double)ep->thresh, ep->noise_floor * EP_SNR_FACTOR);
+    fl_speech = (rms > level);
+    if(!fl_speech) {
+        k = (rms < ep->noise_floor ? EP_NF_FALL : EP_NF_RISE);
+        ep->noise_floor += (rms - ep->noise_floor) * k;
+        if(ep->noise_floor < EP_NF_MIN) { ep->noise_floor = EP_NF_MIN; }
+    }
+
+    if(vad_state == SWITCH_VAD_STATE_STOP_TALKING) {
+        if(ep->fl_talking && decision) {
+            decision->timeout_ms = ivs_endpoint_max_ms(ep);
+            decision->speech_ms = ep->speech_ms;
+            decision->silence_ms = ep->silence_ms;
+            decision->reasons = (ep->reasons | IVS_EP_REASON_MAX);
+        }
+        utterance_reset(ep);
+        return vad_state;
+    }
+    if(vad_state != SWITCH_VAD_STATE_START_TALKING && vad_state != SWITCH_VAD_STATE_TALKING) {
+        return vad_state;
+    }
+
+    ep->fl_talking = true;
+
+    if(fl_speech) {
+        ep->voiced_frames++;
+        ep->speech_ms += frame_ms;
+        ep->energy_avg += (energy - ep->energy_avg) / ep->voiced_frames;
+        k = MIN(1.0, (double)frame_ms / EP_TAIL_MS);
+        ep->energy_tail = (ep->voiced_frames == 1 ? energy : ep->energy_tail + (energy - ep->energy_tail) * k);
+        ep->fl_in_silence = false;
+        ep->silence_ms = 0;
+        return vad_state;
+    }
+
+    if(!ep->fl_in_silence) {
+        ep->fl_in_silence = true;
+        ep->silence_ms = 0;
+        pause_started(ep);
+    }
+    ep->silence_ms += frame_ms;
+
+    if(ep->silence_ms < ep->timeout_ms) {
+        return vad_state;
+    }
+
+    if(decision) {
+        decision->timeout_ms = ep->timeout_ms;
+        decision->speech_ms = ep->speech_ms;
+        decision->silence_ms = ep->silence_ms;
+        decision->reasons = ep->reasons;
+    }
+    utterance_reset(ep);
+
+    return SWITCH_VAD_STATE_STOP_TALKING;
+}
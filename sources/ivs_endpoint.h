@@ -0,0 +1,39 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#ifndef IVS_ENDPOINT_H
+#define IVS_ENDPOINT_H
+
+#include <mod_ivs.h>
+
+#define IVS_EP_BASE_MS                  350     // if vad-silence-ms isn't set
+#define IVS_EP_MIN_MS                   150
+#define IVS_EP_MAX_FACTOR               2       // max hangover = base * factor
+
+struct ivs_endpoint_s {
+    uint32_t                samplerate;
+    uint32_t                channels;
+    uint32_t                base_ms;
+    uint32_t                thresh;         // absolute floor (rms)
+    uint8_t                 fl_short_answer;
+    // utterance
+    uint8_t                 fl_talking;
+    uint8_t                 fl_in_silence;
+    uint32_t                speech_ms;
+    uint32_t                silence_ms;
+    uint32_t                timeout_ms;     // for the current pause
+    uint32_t                reasons;
+    uint64_t                voiced_frames;
+    double                  energy_avg;     // voiced frames, whole utterance
+    double                  energy_tail;    // voiced frames, ~200ms
+    double                  noise_floor;
+};
+
+switch_status_t ivs_endpoint_create(ivs_endpoint_t **ep, uint32_t samplerate, uint32_t channels, switch_memory_pool_t *pool);
+void ivs_endpoint_set_params(ivs_endpoint_t *ep, uint32_t base_ms, uint32_t thresh, uint8_t fl_short_answer);
+uint32_t ivs_endpoint_max_ms(ivs_endpoint_t *ep);
+switch_vad_state_t ivs_endpoint_process(ivs_endpoint_t *ep, switch_vad_state_t vad_state, int16_t *data, uint32_t samples, ivs_endpoint_decision_t *decision);
+
+
+#endif
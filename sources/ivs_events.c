@@ -6,114 +6,255 @@
 
 extern globals_t globals;
 
-void ivs_event_free(ivs_event_t *event) {
-    if(event) {
-        if(event->payload_dh) {
-            event->payload_dh(event->payload);
-        }
-        switch_safe_free(event->payload);
-        switch_safe_free(event);
+switch_status_t ivs_events_queue_create(ivs_events_queue_t **evq, uint32_t size, switch_memory_pool_t *pool) {
+    ivs_events_queue_t *levq = NULL;
+
+    switch_assert(pool);
+
+    if((levq = switch_core_alloc(pool, sizeof(ivs_events_queue_t))) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        return SWITCH_STATUS_MEMERR;
     }
+    if(switch_mutex_init(&levq->mutex, SWITCH_MUTEX_NESTED, pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        return SWITCH_STATUS_MEMERR;
+    }
+    if(switch_queue_create(&levq->queue, size, pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        return SWITCH_STATUS_MEMERR;
+    }
+
+    levq->mask = IVS_EVENTS_MASK_ALL;
+
+    *evq = levq;
+    return SWITCH_STATUS_SUCCESS;
 }
 
-void ivs_events_queue_clean(switch_queue_t *queue) {
+void ivs_events_queue_clean(ivs_events_queue_t *evq) {
     void *data = NULL;
 
-    if(!queue || !switch_queue_size(queue)) { return; }
+    if(!evq || !switch_queue_size(evq->queue)) { return; }
 
-    while(switch_queue_trypop(queue, &data) == SWITCH_STATUS_SUCCESS) {
-        if(data) { ivs_event_free((ivs_event_t *) data); }
+    while(switch_queue_trypop(evq->queue, &data) == SWITCH_STATUS_SUCCESS) {
+        if(data) { ivs_event_release(evq, (ivs_event_t *) data); }
     }
 }
 
-switch_status_t ivs_event_push_simple(switch_queue_t *queue, uint32_t type, char *payload_str) {
+void ivs_events_queue_destroy(ivs_events_queue_t *evq) {
     ivs_event_t *event = NULL;
 
-    switch_assert(queue);
+    if(!evq) { return; }
 
-    switch_zmalloc(event, sizeof(ivs_event_t));
-    event->type = type;
+    ivs_events_queue_clean(evq);
+    switch_queue_term(evq->queue);
 
-    if(payload_str) {
-        event->payload_len = strlen(payload_str);
+    switch_mutex_lock(evq->mutex);
+    while(evq->free_list) {
+        event = evq->free_list;
+        evq->free_list = event->next;
+        switch_safe_free(event);
+    }
+    evq->free_count = 0;
+    switch_mutex_unlock(evq->mutex);
+}
+
+void ivs_events_queue_stats(ivs_events_queue_t *evq, switch_stream_handle_t *stream) {
+    if(!evq) { return; }
+
+    switch_mutex_lock(evq->mutex);
+    stream->write_function(stream, "events: queued=%u, allocs=%u, reuses=%u, payload-allocs=%u, free=%u, filtered=%u, mask=0x%x\n",
+        switch_queue_size(evq->queue), evq->allocs, evq->reuses, evq->payload_allocs, evq->free_count, evq->filtered, evq->mask
+    );
+    switch_mutex_unlock(evq->mutex);
+}
+
+void ivs_events_subscribe(ivs_events_queue_t *evq, uint32_t mask, uint8_t fl_subscribe) {
+    if(!evq) { return; }
+
+    switch_mutex_lock(evq->mutex);
+    evq->mask = (fl_subscribe ? (evq->mask | mask) : (evq->mask & ~mask));
+    switch_mutex_unlock(evq->mutex);
+}
+
+static inline uint8_t ivs_event_filtered(ivs_events_queue_t *evq, uint32_t type) {
+    if(ivs_events_wanted(evq, type)) {
+        return false;
+    }
+
+    switch_mutex_lock(evq->mutex);
+    evq->filtered++;
+    switch_mutex_unlock(evq->mutex);
+
+    return true;
+}
+
+ivs_event_t *ivs_event_alloc(ivs_events_queue_t *evq, uint32_t payload_len) {
+    ivs_event_t *event = NULL;
 
-        switch_malloc(event->payload, event->payload_len + 1);
-        memcpy(event->payload, payload_str, event->payload_len);
+    switch_mutex_lock(evq->mutex);
+    if(evq->free_list) {
+        event = evq->free_list;
+        evq->free_list = event->next;
+        evq->free_count--;
+        evq->reuses++;
+    } else {
+        evq->allocs++;
+    }
+    if(payload_len > IVS_EVENT_PAYLOAD_INLINE) {
+        evq->payload_allocs++;
+    }
+    switch_mutex_unlock(evq->mutex);
+
+    if(!event) {
+        if((event = malloc(sizeof(ivs_event_t))) == NULL) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+            return NULL;
+        }
+    }
+
+    // the inline area isn't cleared, the caller writes payload_len bytes into it
+    event->type = IVS_EVENT_NOP;
+    event->jid = JID_NONE;
+    event->next = NULL;
+    event->payload_dh = NULL;
+    event->payload_len = payload_len;
+    event->payload = NULL;
 
-        event->payload[event->payload_len] = '\0';
+    if(payload_len) {
+        if(payload_len <= IVS_EVENT_PAYLOAD_INLINE) {
+            event->payload = event->payload_inline;
+        } else if((event->payload = malloc(payload_len)) == NULL) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+            ivs_event_release(evq, event);
+            return NULL;
+        }
     }
 
-    if(switch_queue_trypush(queue, event) == SWITCH_STATUS_SUCCESS) {
+    return event;
+}
+
+void ivs_event_release(ivs_events_queue_t *evq, ivs_event_t *event) {
+    if(!event) { return; }
+
+    if(event->payload_dh && event->payload) {
+        event->payload_dh(event->payload);
+    }
+    if(event->payload && event->payload != event->payload_inline) {
+        free(event->payload);
+    }
+    event->payload = NULL;
+    event->payload_dh = NULL;
+
+    switch_mutex_lock(evq->mutex);
+    if(evq->free_count < IVS_EVENTS_FREELIST_MAX) {
+        event->next = evq->free_list;
+        evq->free_list = event;
+        evq->free_count++;
+        event = NULL;
+    }
+    switch_mutex_unlock(evq->mutex);
+
+    switch_safe_free(event);
+}
+
+static switch_status_t ivs_event_enqueue(ivs_events_queue_t *evq, ivs_event_t *event) {
+    if(switch_queue_trypush(evq->queue, event) == SWITCH_STATUS_SUCCESS) {
         return SWITCH_STATUS_SUCCESS;
     }
 
-    ivs_event_free(event);
+    ivs_event_release(evq, event);
     return SWITCH_STATUS_FALSE;
 }
 
-switch_status_t ivs_event_push_dh(switch_queue_t *queue, uint32_t jid, uint32_t type, void *payload, uint32_t payload_len, mem_destroy_handler_t *payload_dh) {
+switch_status_t ivs_event_push_simple(ivs_events_queue_t *evq, uint32_t type, char *payload_str) {
     ivs_event_t *event = NULL;
+    uint32_t len = 0;
 
-    switch_assert(queue);
+    switch_assert(evq);
 
-    switch_zmalloc(event, sizeof(ivs_event_t));
-    event->jid = jid;
+    if(ivs_event_filtered(evq, type)) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    len = (payload_str ? strlen(payload_str) : 0);
+    if((event = ivs_event_alloc(evq, (payload_str ? len + 1 : 0))) == NULL) {
+        return SWITCH_STATUS_MEMERR;
+    }
     event->type = type;
-    event->payload_dh = payload_dh;
-    event->payload_len = payload_len;
 
-    if(payload_len) {
-        switch_malloc(event->payload, payload_len);
-        memcpy(event->payload, payload, payload_len);
+    if(payload_str) {
+        memcpy(event->payload, payload_str, len);
+        event->payload[len] = '\0';
+        event->payload_len = len;
     }
 
-    if(switch_queue_trypush(queue, event) == SWITCH_STATUS_SUCCESS) {
+    return ivs_event_enqueue(evq, event);
+}
+
+/**
+ * the payload is moved: its content goes into the event (inline when small) and
+ * whatever it points to belongs to the event from now on (payload_dh), also on failure
+ **/
+switch_status_t ivs_event_push_dh(ivs_events_queue_t *evq, uint32_t jid, uint32_t type, void *payload, uint32_t payload_len, mem_destroy_handler_t *payload_dh) {
+    ivs_event_t *event = NULL;
+
+    switch_assert(evq);
+
+    if(ivs_event_filtered(evq, type)) {
+        if(payload_dh && payload) { payload_dh(payload); }
         return SWITCH_STATUS_SUCCESS;
     }
 
-    ivs_event_free(event);
-    return SWITCH_STATUS_FALSE;
+    if((event = ivs_event_alloc(evq, payload_len)) == NULL) {
+        if(payload_dh && payload) { payload_dh(payload); }
+        return SWITCH_STATUS_MEMERR;
+    }
+    event->jid = jid;
+    event->type = type;
+
+    if(payload_len) {
+        memcpy(event->payload, payload, payload_len);
+        event->payload_dh = payload_dh;
+    }
+
+    return ivs_event_enqueue(evq, event);
 }
 
 
-// -----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------// chunk ready
+// -----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+// chunk ready
 static void ivs_event_payload_free_mchunk(ivs_event_payload_mchunk_t *chunk) {
     if(chunk) {
         switch_safe_free(chunk->data);
     }
 }
 
-switch_status_t ivs_event_push_chunk_ready(switch_queue_t *queue, uint32_t samplerate, uint32_t channels, uint32_t time, uint32_t length, switch_byte_t *data, uint32_t data_len) {
-    ivs_event_payload_mchunk_t *mchunk = NULL;
+switch_status_t ivs_event_push_chunk_ready(ivs_events_queue_t *evq, ivs_event_payload_mchunk_t *hdr, switch_byte_t *data, uint32_t data_len) {
+    ivs_event_payload_mchunk_t mchunk = *hdr;
 
-    switch_zmalloc(mchunk, sizeof(ivs_event_payload_mchunk_t));
-    mchunk->time = time;
-    mchunk->length = length;
-    mchunk->channels = channels;
-    mchunk->samplerate = samplerate;
-    mchunk->data_len = data_len;
+    if(ivs_event_filtered(evq, IVS_EVENT_CHUNK_READY)) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    mchunk.data = NULL;
+    mchunk.data_len = data_len;
 
     if(data_len) {
-        switch_malloc(mchunk->data, data_len + 1);
-        memcpy(mchunk->data, data, data_len);
-        mchunk->data[data_len] = '\0';
+        switch_malloc(mchunk.data, data_len + 1);
+        memcpy(mchunk.data, data, data_len);
+        mchunk.data[data_len] = '\0';
     }
 
-    return ivs_event_push_dh(queue, JID_NONE, IVS_EVENT_CHUNK_READY, mchunk, sizeof(ivs_event_payload_mchunk_t), (mem_destroy_handler_t *)ivs_event_payload_free_mchunk);
+    return ivs_event_push_dh(evq, JID_NONE, IVS_EVENT_CHUNK_READY, &mchunk, sizeof(ivs_event_payload_mchunk_t), (mem_destroy_handler_t *)ivs_event_payload_free_mchunk);
 }
 
-switch_status_t ivs_event_push_chunk_ready_zerocopy(switch_queue_t *queue, uint32_t samplerate, uint32_t channels, uint32_t time, uint32_t length, switch_byte_t *data, uint32_t data_len) {
-    ivs_event_payload_mchunk_t *mchunk = NULL;
+switch_status_t ivs_event_push_chunk_ready_zerocopy(ivs_events_queue_t *evq, ivs_event_payload_mchunk_t *hdr, switch_byte_t *data, uint32_t data_len) {
+    ivs_event_payload_mchunk_t mchunk = *hdr;
 
-    switch_zmalloc(mchunk, sizeof(ivs_event_payload_mchunk_t));
-    mchunk->time = time;
-    mchunk->length = length;
-    mchunk->channels = channels;
-    mchunk->samplerate = samplerate;
-    mchunk->data_len = data_len;
-    mchunk->data = data;
+    mchunk.data = data;
+    mchunk.data_len = data_len;
 
-    return ivs_event_push_dh(queue, JID_NONE, IVS_EVENT_CHUNK_READY, mchunk, sizeof(ivs_event_payload_mchunk_t), (mem_destroy_handler_t *)ivs_event_payload_free_mchunk);
+    return ivs_event_push_dh(evq, JID_NONE, IVS_EVENT_CHUNK_READY, &mchunk, sizeof(ivs_event_payload_mchunk_t), (mem_destroy_handler_t *)ivs_event_payload_free_mchunk);
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -134,20 +275,31 @@ switch_status_t ivs_event_payload_nlp_alloc(ivs_event_payload_nlp_t **payload, c
     *payload = lpayload;
     return SWITCH_STATUS_SUCCESS;
 }
-switch_status_t ivs_event_push_nlp(switch_queue_t *queue, uint32_t jid, char *role, char *text) {
+switch_status_t ivs_event_push_nlp(ivs_events_queue_t *evq, uint32_t jid, char *role, char *text) {
+    ivs_event_payload_nlp_t payload = { 0 };
+
+    if(ivs_event_filtered(evq, IVS_EVENT_NLP_DONE)) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    payload.role = (role ? strdup(role) : NULL);
+    payload.text = (text ? strdup(text) : NULL);
+
+    return ivs_event_push_dh(evq, jid, IVS_EVENT_NLP_DONE, &payload, sizeof(ivs_event_payload_nlp_t), (mem_destroy_handler_t *)ivs_event_payload_nlp_free);
+}
+switch_status_t ivs_event_push_nlp2(ivs_events_queue_t *evq, uint32_t jid, ivs_event_payload_nlp_t *payload) {
     switch_status_t status = SWITCH_STATUS_SUCCESS;
-    ivs_event_payload_nlp_t *payload = NULL;
 
-    status = ivs_event_payload_nlp_alloc(&payload, role, text);
-    if(status == SWITCH_STATUS_SUCCESS) {
-        status = ivs_event_push_dh(queue, jid, IVS_EVENT_NLP_DONE, payload, sizeof(ivs_event_payload_nlp_t), (mem_destroy_handler_t *)ivs_event_payload_nlp_free);
+    if(ivs_event_filtered(evq, IVS_EVENT_NLP_DONE)) {
+        ivs_event_payload_nlp_free(payload);
+        switch_safe_free(payload);
+        return SWITCH_STATUS_SUCCESS;
     }
 
+    status = ivs_event_push_dh(evq, jid, IVS_EVENT_NLP_DONE, payload, sizeof(ivs_event_payload_nlp_t), (mem_destroy_handler_t *)ivs_event_payload_nlp_free);
+    switch_safe_free(payload);
     return status;
 }
-switch_status_t ivs_event_push_nlp2(switch_queue_t *queue, uint32_t jid, ivs_event_payload_nlp_t *payload) {
-    return ivs_event_push_dh(queue, jid, IVS_EVENT_NLP_DONE, payload, sizeof(ivs_event_payload_nlp_t), (mem_destroy_handler_t *)ivs_event_payload_nlp_free);
-}
 
 // -----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 // transcription-finished
@@ -167,20 +319,31 @@ switch_status_t ivs_event_payload_transcription_alloc(ivs_event_payload_transcri
     return SWITCH_STATUS_SUCCESS;
 }
 
-switch_status_t ivs_event_push_transcription(switch_queue_t *queue, uint32_t jid, double confidence, char *text) {
-    switch_status_t status = SWITCH_STATUS_SUCCESS;
-    ivs_event_payload_transcription_t *payload = NULL;
+switch_status_t ivs_event_push_transcription(ivs_events_queue_t *evq, uint32_t jid, double confidence, char *text) {
+    ivs_event_payload_transcription_t payload = { 0 };
 
-    status = ivs_event_payload_transcription_alloc(&payload, confidence, text);
-    if(status == SWITCH_STATUS_SUCCESS) {
-        status = ivs_event_push_dh(queue, jid, IVS_EVENT_TRANSCRIPTION_DONE, payload, sizeof(ivs_event_payload_transcription_t), (mem_destroy_handler_t *)ivs_event_payload_transcription_free);
+    if(ivs_event_filtered(evq, IVS_EVENT_TRANSCRIPTION_DONE)) {
+        return SWITCH_STATUS_SUCCESS;
     }
 
-    return status;
+    payload.confidence = confidence;
+    payload.text = (text ? strdup(text) : NULL);
+
+    return ivs_event_push_dh(evq, jid, IVS_EVENT_TRANSCRIPTION_DONE, &payload, sizeof(ivs_event_payload_transcription_t), (mem_destroy_handler_t *)ivs_event_payload_transcription_free);
 }
 
-switch_status_t ivs_event_push_transcription2(switch_queue_t *queue, uint32_t jid, ivs_event_payload_transcription_t *payload) {
-    return ivs_event_push_dh(queue, jid, IVS_EVENT_TRANSCRIPTION_DONE, payload, sizeof(ivs_event_payload_transcription_t), (mem_destroy_handler_t *)ivs_event_payload_transcription_free);
+switch_status_t ivs_event_push_transcription2(ivs_events_queue_t *evq, uint32_t jid, ivs_event_payload_transcription_t *payload) {
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+
+    if(ivs_event_filtered(evq, IVS_EVENT_TRANSCRIPTION_DONE)) {
+        ivs_event_payload_transcription_free(payload);
+        switch_safe_free(payload);
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    status = ivs_event_push_dh(evq, jid, IVS_EVENT_TRANSCRIPTION_DONE, payload, sizeof(ivs_event_payload_transcription_t), (mem_destroy_handler_t *)ivs_event_payload_transcription_free);
+    switch_safe_free(payload);
+    return status;
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -208,20 +371,56 @@ switch_status_t ivs_event_payload_curl_alloc(ivs_event_payload_curl_t **payload,
     return SWITCH_STATUS_SUCCESS;
 }
 
-switch_status_t ivs_event_push_curl(switch_queue_t *queue, uint32_t jid, uint32_t http_code, char *body, uint32_t body_len) {
+switch_status_t ivs_event_push_curl(ivs_events_queue_t *evq, uint32_t jid, uint32_t http_code, char *body, uint32_t body_len) {
+    ivs_event_payload_curl_t payload = { 0 };
+
+    if(ivs_event_filtered(evq, IVS_EVENT_CURL_DONE)) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    payload.http_code = http_code;
+    if(body_len > 0) {
+        switch_malloc(payload.body, body_len);
+        memcpy(payload.body, body, body_len);
+        payload.body_len = body_len;
+    }
+
+    return ivs_event_push_dh(evq, jid, IVS_EVENT_CURL_DONE, &payload, sizeof(ivs_event_payload_curl_t), (mem_destroy_handler_t *)ivs_event_payload_curl_free);
+}
+
+switch_status_t ivs_event_push_curl2(ivs_events_queue_t *evq, uint32_t jid, ivs_event_payload_curl_t *payload) {
     switch_status_t status = SWITCH_STATUS_SUCCESS;
-    ivs_event_payload_curl_t *payload = NULL;
 
-    status = ivs_event_payload_curl_alloc(&payload, http_code, body, body_len);
-    if(status == SWITCH_STATUS_SUCCESS) {
-        status = ivs_event_push_dh(queue, jid, IVS_EVENT_CURL_DONE, payload, sizeof(ivs_event_payload_curl_t), (mem_destroy_handler_t *)ivs_event_payload_curl_free);
+    if(ivs_event_filtered(evq, IVS_EVENT_CURL_DONE)) {
+        ivs_event_payload_curl_free(payload);
+        switch_safe_free(payload);
+        return SWITCH_STATUS_SUCCESS;
     }
 
+    status = ivs_event_push_dh(evq, jid, IVS_EVENT_CURL_DONE, payload, sizeof(ivs_event_payload_curl_t), (mem_destroy_handler_t *)ivs_event_payload_curl_free);
+    switch_safe_free(payload);
     return status;
 }
 
-switch_status_t ivs_event_push_curl2(switch_queue_t *queue, uint32_t jid, ivs_event_payload_curl_t *payload) {
-    return ivs_event_push_dh(queue, jid, IVS_EVENT_CURL_DONE, payload, sizeof(ivs_event_payload_curl_t), (mem_destroy_handler_t *)ivs_event_payload_curl_free);
+// -----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+// dtmf
+switch_status_t ivs_event_push_dtmf(ivs_events_queue_t *evq, char digit, uint32_t duration_ms) {
+    ivs_event_payload_dtmf_t payload = { 0 };
+
+    payload.digit = digit;
+    payload.duration_ms = duration_ms;
+    payload.timestamp = (switch_micro_time_now() / 1000);
+
+    return ivs_event_push_dh(evq, JID_NONE, IVS_EVENT_DTMF, &payload, sizeof(ivs_event_payload_dtmf_t), NULL);
 }
 
+switch_status_t ivs_event_push_dtmf_collected(ivs_events_queue_t *evq, const char *digits, uint32_t reason) {
+    ivs_event_payload_dtmf_collected_t payload = { 0 };
 
+    if(digits) {
+        switch_copy_string(payload.digits, digits, sizeof(payload.digits));
+    }
+    payload.reason = reason;
+
+    return ivs_event_push_dh(evq, JID_NONE, IVS_EVENT_DTMF_COLLECTED, &payload, sizeof(ivs_event_payload_dtmf_collected_t), NULL);
+}
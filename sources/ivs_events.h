@@ -16,38 +16,80 @@
 #define IVS_EVENT_TRANSCRIPTION_DONE        0x06
 #define IVS_EVENT_NLP_DONE                  0x07
 #define IVS_EVENT_CURL_DONE                 0x08
+#define IVS_EVENT_BARGE_IN                  0x09
+#define IVS_EVENT_DTMF                      0x0A
+#define IVS_EVENT_DTMF_COLLECTED            0x0B
 
 
+#define IVS_EVENT_MASK(type)                (1U << (type))
+#define IVS_EVENTS_MASK_ALL                 0xffffffff
+
+#define IVS_EVENT_PAYLOAD_INLINE            128     // payloads up to this size are kept in the event itself
+#define IVS_EVENTS_FREELIST_MAX             32      // released events kept per session
+
 typedef void (mem_destroy_handler_t)(void *data);
 
 // -----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-typedef struct {
+typedef struct ivs_event_s {
     uint32_t                type;
     uint32_t                jid;
     uint32_t                payload_len;
-    uint8_t                 *payload;
+    uint8_t                 *payload;       // -> payload_inline or malloc'ed
     mem_destroy_handler_t   *payload_dh;
+    struct ivs_event_s      *next;          // freelist
+    uint8_t                 payload_inline[IVS_EVENT_PAYLOAD_INLINE] __attribute__((aligned(8)));
 } ivs_event_t;
 
-void ivs_event_free(ivs_event_t *event);
-void ivs_events_queue_clean(switch_queue_t *queue);
+/**
+ * the session events queue, released events are recycled through a small freelist
+ * (the producers are the media/worker/curl threads, the consumer is the script)
+ **/
+struct ivs_events_queue_s {
+    switch_queue_t          *queue;
+    switch_mutex_t          *mutex;
+    uint32_t                mask;           // IVS_EVENT_MASK() of the types the script wants (ivs.subscribe)
+    ivs_event_t             *free_list;
+    uint32_t                free_count;
+    uint32_t                allocs;         // events malloc'ed
+    uint32_t                reuses;         // events taken from the freelist
+    uint32_t                payload_allocs; // payloads that didn't fit inline
+    uint32_t                filtered;       // dropped by the mask
+};
+
+switch_status_t ivs_events_queue_create(ivs_events_queue_t **evq, uint32_t size, switch_memory_pool_t *pool);
+void ivs_events_queue_destroy(ivs_events_queue_t *evq);
+void ivs_events_queue_clean(ivs_events_queue_t *evq);
+void ivs_events_queue_stats(ivs_events_queue_t *evq, switch_stream_handle_t *stream);
+void ivs_events_subscribe(ivs_events_queue_t *evq, uint32_t mask, uint8_t fl_subscribe);
+#define ivs_events_wanted(evq, type) ((evq)->mask & IVS_EVENT_MASK(type))
 
-#define ivs_event_push(queue, jid, type, payload, payload_len) ivs_event_push_dh(queue, jid, type, payload, payload_len, NULL);
-switch_status_t ivs_event_push_simple(switch_queue_t *queue, uint32_t type, char *payload_str);
-switch_status_t ivs_event_push_dh(switch_queue_t *queue, uint32_t jid, uint32_t type, void *payload, uint32_t payload_len, mem_destroy_handler_t *payload_dh);
+ivs_event_t *ivs_event_alloc(ivs_events_queue_t *evq, uint32_t payload_len);
+void ivs_event_release(ivs_events_queue_t *evq, ivs_event_t *event);
+
+#define ivs_event_push(evq, jid, type, payload, payload_len) ivs_event_push_dh(evq, jid, type, payload, payload_len, NULL)
+switch_status_t ivs_event_push_simple(ivs_events_queue_t *evq, uint32_t type, char *payload_str);
+switch_status_t ivs_event_push_dh(ivs_events_queue_t *evq, uint32_t jid, uint32_t type, void *payload, uint32_t payload_len, mem_destroy_handler_t *payload_dh);
 
 // -----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 /* chunk ready , L16 codec */
 typedef struct {
+    uint32_t        type;       // IVS_CHUNK_TYPE_*
+    uint32_t        encoding;   // IVS_CHUNK_ENCODING_*
     uint32_t        samplerate;
     uint32_t        channels;
     uint32_t        time;       // chunk size in sec
     uint32_t        length;     // chunk size in bytes
+    uint32_t        utterance;  // utterance id
+    uint32_t        seq;        // chunk number in the utterance
+    uint8_t         final;      // last chunk of the utterance
+    uint32_t        duration_ms;        // as sent
+    uint32_t        orig_duration_ms;   // before compaction
+    ivs_endpoint_decision_t endpoint;   // final chunk of the utterance, adaptive endpointing only
     uint32_t        data_len;   // actual data length
     uint8_t         *data;      // samples
 } ivs_event_payload_mchunk_t;
-switch_status_t ivs_event_push_chunk_ready(switch_queue_t *queue, uint32_t samplerate, uint32_t channels, uint32_t time, uint32_t length, switch_byte_t *data, uint32_t data_len);
-switch_status_t ivs_event_push_chunk_ready_zerocopy(switch_queue_t *queue, uint32_t samplerate, uint32_t channels, uint32_t time, uint32_t length, switch_byte_t *data, uint32_t data_len);
+switch_status_t ivs_event_push_chunk_ready(ivs_events_queue_t *evq, ivs_event_payload_mchunk_t *hdr, switch_byte_t *data, uint32_t data_len);
+switch_status_t ivs_event_push_chunk_ready_zerocopy(ivs_events_queue_t *evq, ivs_event_payload_mchunk_t *hdr, switch_byte_t *data, uint32_t data_len);
 
 // -----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 /* nlp result */
@@ -57,8 +99,9 @@ typedef struct {
 } ivs_event_payload_nlp_t;
 void ivs_event_payload_nlp_free(ivs_event_payload_nlp_t *payload);
 switch_status_t ivs_event_payload_nlp_alloc(ivs_event_payload_nlp_t **payload, char *role, char *text);
-switch_status_t ivs_event_push_nlp(switch_queue_t *queue, uint32_t jid, char *role, char *text);
-switch_status_t ivs_event_push_nlp2(switch_queue_t *queue, uint32_t jid, ivs_event_payload_nlp_t *payload);
+switch_status_t ivs_event_push_nlp(ivs_events_queue_t *evq, uint32_t jid, char *role, char *text);
+/* *2: the payload (from *_alloc) is moved into the event and freed, also on failure */
+switch_status_t ivs_event_push_nlp2(ivs_events_queue_t *evq, uint32_t jid, ivs_event_payload_nlp_t *payload);
 
 // -----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 /* transcript result */
@@ -68,8 +111,8 @@ typedef struct {
 } ivs_event_payload_transcription_t;
 void ivs_event_payload_transcription_free(ivs_event_payload_transcription_t *payload);
 switch_status_t ivs_event_payload_transcription_alloc(ivs_event_payload_transcription_t **payload, double confidence, char *text);
-switch_status_t ivs_event_push_transcription(switch_queue_t *queue, uint32_t jid, double confidence, char *text);
-switch_status_t ivs_event_push_transcription2(switch_queue_t *queue, uint32_t jid, ivs_event_payload_transcription_t *payload);
+switch_status_t ivs_event_push_transcription(ivs_events_queue_t *evq, uint32_t jid, double confidence, char *text);
+switch_status_t ivs_event_push_transcription2(ivs_events_queue_t *evq, uint32_t jid, ivs_event_payload_transcription_t *payload);
 
 // -----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 /* curl result */
@@ -80,7 +123,23 @@ typedef struct {
 } ivs_event_payload_curl_t;
 void ivs_event_payload_curl_free(ivs_event_payload_curl_t *payload);
 switch_status_t ivs_event_payload_curl_alloc(ivs_event_payload_curl_t **payload, uint32_t http_code, char *body, uint32_t body_len);
-switch_status_t ivs_event_push_curl(switch_queue_t *queue, uint32_t jid, uint32_t http_code, char *body, uint32_t body_len);
-switch_status_t ivs_event_push_curl2(switch_queue_t *queue, uint32_t jid, ivs_event_payload_curl_t *payload);
+switch_status_t ivs_event_push_curl(ivs_events_queue_t *evq, uint32_t jid, uint32_t http_code, char *body, uint32_t body_len);
+switch_status_t ivs_event_push_curl2(ivs_events_queue_t *evq, uint32_t jid, ivs_event_payload_curl_t *payload);
+
+// -----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+/* dtmf digit */
+typedef struct {
+    char            digit;
+    uint32_t        duration_ms;
+    switch_time_t   timestamp;  // ms (epoch)
+} ivs_event_payload_dtmf_t;
+switch_status_t ivs_event_push_dtmf(ivs_events_queue_t *evq, char digit, uint32_t duration_ms);
+
+/* digits collected (ivs.collectDigits) */
+typedef struct {
+    char            digits[IVS_DTMF_DIGITS_MAX + 1];
+    uint32_t        reason;     // IVS_DTMF_COLLECT_*
+} ivs_event_payload_dtmf_collected_t;
+switch_status_t ivs_event_push_dtmf_collected(ivs_events_queue_t *evq, const char *digits, uint32_t reason);
 
 #endif
@@ -0,0 +1,442 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#include <ivs_filters.h>
+#include <ivs_echo.h>
+#include <ivs_denoise.h>
+#include <time.h>
+
+extern globals_t globals;
+
+static switch_mutex_t *filters_mutex = NULL;
+static switch_hash_t *filters = NULL;
+
+static inline uint64_t filters_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static inline uint32_t hist_bin(uint64_t ns) {
+    uint64_t us = (ns / 1000);
+    uint32_t bin = 0;
+
+    while(us > 0 && bin < (IVS_FILTER_HIST_BINS - 1)) { us >>= 1; bin++; }
+    return bin;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// built-in: echo-gate
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+typedef struct {
+    ivs_session_t           *ivs_session;
+    ivs_echo_gate_t         *gate;
+    switch_time_t           ref_ts;
+} echo_filter_t;
+
+static switch_status_t echo_filter_init(void **ctx, ivs_session_t *ivs_session, switch_memory_pool_t *pool) {
+    echo_filter_t *ef = NULL;
+
+    if((ef = switch_core_alloc(pool, sizeof(echo_filter_t))) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        return SWITCH_STATUS_MEMERR;
+    }
+    if(ivs_echo_gate_create(&ef->gate, ivs_session->session, globals.cfg_echo_tail_ms, globals.cfg_echo_erl_db, pool) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    ef->ivs_session = ivs_session;
+    *ctx = ef;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void echo_filter_process(void *ctx, int16_t *data, uint32_t samples) {
+    echo_filter_t *ef = (echo_filter_t *)ctx;
+
+    // own prompts coming back from the trunk (playback + tail)
+    if(ivs_session_xflags_test(ef->ivs_session, IVS_SF_PLAYBACK)) { ef->ref_ts = switch_micro_time_now(); }
+    if(ef->ref_ts && (switch_micro_time_now() - ef->ref_ts) <= (ef->gate->tail_ms * 1000)) {
+        ivs_echo_gate_process(ef->gate, data, samples);
+    }
+}
+
+static void echo_filter_destroy(void *ctx) {
+    echo_filter_t *ef = (echo_filter_t *)ctx;
+    ivs_echo_gate_destroy(&ef->gate, ef->ivs_session->session);
+}
+
+static void echo_filter_stats(void *ctx, switch_stream_handle_t *stream) {
+    echo_filter_t *ef = (echo_filter_t *)ctx;
+    ivs_echo_gate_stats(ef->gate, stream);
+}
+
+static const ivs_audio_filter_t echo_filter = {
+    "echo-gate", echo_filter_init, echo_filter_process, echo_filter_destroy, echo_filter_stats
+};
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// built-in: denoise
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+static switch_status_t denoise_filter_init(void **ctx, ivs_session_t *ivs_session, switch_memory_pool_t *pool) {
+    ivs_denoise_t *dn = NULL;
+
+    if(ivs_session->channels != 1) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "denoise: mono only (channels=%u)\n", ivs_session->channels);
+        return SWITCH_STATUS_FALSE;
+    }
+    if(ivs_denoise_create(&dn, ivs_session->samplerate, (AUDIO_BUFFER_SIZE / sizeof(int16_t)), pool) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    *ctx = dn;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void denoise_filter_process(void *ctx, int16_t *data, uint32_t samples) {
+    ivs_denoise_process((ivs_denoise_t *)ctx, data, samples);
+}
+
+static void denoise_filter_stats(void *ctx, switch_stream_handle_t *stream) {
+    ivs_denoise_stats((ivs_denoise_t *)ctx, stream);
+}
+
+static const ivs_audio_filter_t denoise_filter = {
+    "denoise", denoise_filter_init, denoise_filter_process, NULL, denoise_filter_stats
+};
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+static switch_status_t stage_init(ivs_filter_stage_t *stage, const ivs_audio_filter_t *filter, ivs_session_t *ivs_session) {
+    switch_memory_pool_t *pool = NULL;
+
+    if(switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "pool fail\n");
+        return SWITCH_STATUS_FALSE;
+    }
+    if(filter->init(&stage->ctx, ivs_session, pool) != SWITCH_STATUS_SUCCESS) {
+        switch_core_destroy_memory_pool(&pool);
+        stage->ctx = NULL;
+        return SWITCH_STATUS_FALSE;
+    }
+
+    stage->filter = filter;
+    stage->pool = pool;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void stage_destroy(ivs_filter_stage_t *stage) {
+    if(stage->filter && stage->filter->destroy) {
+        stage->filter->destroy(stage->ctx);
+    }
+    if(stage->pool) {
+        switch_core_destroy_memory_pool(&stage->pool);
+    }
+    stage->ctx = NULL;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// public
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+switch_status_t ivs_audio_filters_init(switch_memory_pool_t *pool) {
+    switch_assert(pool);
+
+    switch_mutex_init(&filters_mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_core_hash_init(&filters);
+
+    ivs_audio_filter_register(&echo_filter);
+    ivs_audio_filter_register(&denoise_filter);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void ivs_audio_filters_shutdown() {
+    if(filters) {
+        switch_core_hash_destroy(&filters);
+    }
+}
+
+/**
+ * the filter should stay alive until the module is unloaded
+ **/
+switch_status_t ivs_audio_filter_register(const ivs_audio_filter_t *filter) {
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+
+    if(!filters || !filter || zstr(filter->name) || !filter->init || !filter->process) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch_mutex_lock(filters_mutex);
+    if(switch_core_hash_find(filters, filter->name)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Filter already registered: %s\n", filter->name);
+        status = SWITCH_STATUS_FALSE;
+    } else {
+        switch_core_hash_insert(filters, filter->name, filter);
+    }
+    switch_mutex_unlock(filters_mutex);
+
+    return status;
+}
+
+const ivs_audio_filter_t *ivs_audio_filter_lookup(const char *name) {
+    const ivs_audio_filter_t *filter = NULL;
+
+    if(!filters || zstr(name)) { return NULL; }
+
+    switch_mutex_lock(filters_mutex);
+    filter = switch_core_hash_find(filters, name);
+    switch_mutex_unlock(filters_mutex);
+
+    return filter;
+}
+
+/**
+ * spec: comma separated names, in the processing order (e.g.: "echo-gate,denoise")
+ * chain = NULL if there is nothing to run
+ **/
+switch_status_t ivs_filter_chain_create(ivs_filter_chain_t **chain, ivs_session_t *ivs_session, const char *spec) {
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    ivs_filter_chain_t *chain_local = NULL;
+    switch_memory_pool_t *pool = NULL;
+    char *names[IVS_FILTER_CHAIN_MAX] = { 0 };
+    char *spec_dup = NULL;
+    int names_count = 0;
+
+    *chain = NULL;
+
+    if(zstr(spec)) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if(switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "pool fail\n");
+        switch_goto_status(SWITCH_STATUS_FALSE, out);
+    }
+    if((chain_local = switch_core_alloc(pool, sizeof(ivs_filter_chain_t))) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        switch_goto_status(SWITCH_STATUS_MEMERR, out);
+    }
+    chain_local->pool = pool;
+
+    spec_dup = switch_core_strdup(pool, spec);
+    names_count = switch_separate_string(spec_dup, ',', names, (sizeof(names) / sizeof(names[0])));
+
+    for(int i = 0; i < names_count; i++) {
+        const ivs_audio_filter_t *filter = NULL;
+        ivs_filter_stage_t *stage = &chain_local->stages[chain_local->stages_count];
+        char *name = switch_strip_whitespace(names[i]);
+
+        if(zstr(name)) {
+            switch_safe_free(name);
+            continue;
+        }
+        if((filter = ivs_audio_filter_lookup(name)) == NULL) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unknown filter: %s (skipped)\n", name);
+        } else if(stage_init(stage, filter, ivs_session) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Filter init fail: %s (skipped)\n", name);
+        } else {
+            chain_local->stages_count++;
+        }
+        switch_safe_free(name);
+    }
+
+    if(!chain_local->stages_count) {
+        goto out;
+    }
+
+    *chain = chain_local;
+    pool = NULL;
+out:
+    if(pool) {
+        switch_core_destroy_memory_pool(&pool);
+    }
+    return status;
+}
+
+void ivs_filter_chain_destroy(ivs_filter_chain_t **chain) {
+    switch_memory_pool_t *pool = NULL;
+
+    if(!chain || !*chain) { return; }
+
+    for(uint32_t i = 0; i < (*chain)->stages_count; i++) {
+        stage_destroy(&(*chain)->stages[i]);
+    }
+
+    pool = (*chain)->pool;
+    *chain = NULL;
+
+    switch_core_destroy_memory_pool(&pool);
+}
+
+/**
+ * applies a new spec to the existing chain:
+ * stages with the same filter keep their ctx and counters, only added/removed ones are init/destroyed.
+ * the stages array is swapped under the session mutex (stats readers),
+ * every stage has its own pool, nothing is left behind in the chain pool.
+ * chain = NULL: works as ivs_filter_chain_create()
+ **/
+switch_status_t ivs_filter_chain_update(ivs_filter_chain_t **chain, ivs_session_t *ivs_session, const char *spec) {
+    ivs_filter_chain_t *chain_local = (chain ? *chain : NULL);
+    ivs_filter_stage_t stages[IVS_FILTER_CHAIN_MAX] = { 0 };
+    ivs_filter_stage_t removed[IVS_FILTER_CHAIN_MAX] = { 0 };
+    uint8_t kept[IVS_FILTER_CHAIN_MAX] = { 0 };
+    char *names[IVS_FILTER_CHAIN_MAX] = { 0 };
+    char *spec_dup = NULL;
+    uint32_t stages_count = 0, removed_count = 0;
+    int names_count = 0;
+
+    if(!chain) {
+        return SWITCH_STATUS_FALSE;
+    }
+    if(!chain_local) {
+        return ivs_filter_chain_create(chain, ivs_session, spec);
+    }
+
+    if(!zstr(spec)) {
+        spec_dup = strdup(spec);
+        names_count = switch_separate_string(spec_dup, ',', names, (sizeof(names) / sizeof(names[0])));
+    }
+
+    for(int i = 0; i < names_count; i++) {
+        const ivs_audio_filter_t *filter = NULL;
+        ivs_filter_stage_t *stage = &stages[stages_count];
+        char *name = switch_strip_whitespace(names[i]);
+        uint8_t found = false;
+
+        if(zstr(name)) {
+            switch_safe_free(name);
+            continue;
+        }
+        if((filter = ivs_audio_filter_lookup(name)) == NULL) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unknown filter: %s (skipped)\n", name);
+            switch_safe_free(name);
+            continue;
+        }
+
+        for(uint32_t j = 0; j < chain_local->stages_count; j++) {
+            if(!kept[j] && chain_local->stages[j].filter == filter) {
+                *stage = chain_local->stages[j];
+                kept[j] = true;
+                found = true;
+                break;
+            }
+        }
+
+        if(found) {
+            stages_count++;
+        } else if(stage_init(stage, filter, ivs_session) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Filter init fail: %s (skipped)\n", name);
+        } else {
+            stages_count++;
+        }
+        switch_safe_free(name);
+    }
+    switch_safe_free(spec_dup);
+
+    for(uint32_t j = 0; j < chain_local->stages_count; j++) {
+        if(!kept[j]) { removed[removed_count++] = chain_local->stages[j]; }
+    }
+
+    switch_mutex_lock(ivs_session->mutex);
+    memcpy(chain_local->stages, stages, sizeof(stages));
+    chain_local->stages_count = stages_count;
+    switch_mutex_unlock(ivs_session->mutex);
+
+    for(uint32_t j = 0; j < removed_count; j++) {
+        stage_destroy(&removed[j]);
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * in place, stages run one by one on the same buffer
+ **/
+void ivs_filter_chain_process(ivs_filter_chain_t *chain, int16_t *data, uint32_t samples) {
+    if(!chain || !samples) { return; }
+
+    for(uint32_t i = 0; i < chain->stages_count; i++) {
+        ivs_filter_stage_t *stage = &chain->stages[i];
+        uint64_t ts = filters_now_ns(), te = 0;
+
+        stage->filter->process(stage->ctx, data, samples);
+
+        te = filters_now_ns() - ts;
+        stage->frames++;
+        stage->cost_ns += te;
+        if(te > stage->cost_max_ns) { stage->cost_max_ns = te; }
+        stage->hist[hist_bin(te)]++;
+    }
+}
+
+void ivs_filter_chain_stats(ivs_filter_chain_t *chain, switch_stream_handle_t *stream) {
+    if(!chain) { return; }
+
+    for(uint32_t i = 0; i < chain->stages_count; i++) {
+        ivs_filter_stage_t *stage = &chain->stages[i];
+
+        stream->write_function(stream, "filter[%s]: frames=%"SWITCH_UINT64_T_FMT", cost-ns: avg=%"SWITCH_UINT64_T_FMT", max=%"SWITCH_UINT64_T_FMT"\n",
+            stage->filter->name, stage->frames, (stage->frames ? stage->cost_ns / stage->frames : 0), stage->cost_max_ns);
+
+        stream->write_function(stream, "filter[%s]: hist-us:", stage->filter->name);
+        for(uint32_t b = 0; b < IVS_FILTER_HIST_BINS; b++) {
+            if(b < IVS_FILTER_HIST_BINS - 1) {
+                stream->write_function(stream, " <%u=%"SWITCH_UINT64_T_FMT, (1U << b), stage->hist[b]);
+            } else {
+                stream->write_function(stream, " >=%u=%"SWITCH_UINT64_T_FMT, (1U << (b - 1)), stage->hist[b]);
+            }
+        }
+        stream->write_function(stream, "\n");
+
+        if(stage->filter->stats) {
+            stage->filter->stats(stage->ctx, stream);
+        }
+    }
+}
+
+uint8_t ivs_filter_spec_has(const char *spec, const char *name) {
+    size_t len = (name ? strlen(name) : 0);
+    const char *p = spec;
+
+    if(zstr(spec) || !len) { return false; }
+
+    while((p = strstr(p, name)) != NULL) {
+        uint8_t start_ok = (p == spec || p[-1] == ',' || p[-1] == ' ');
+        uint8_t end_ok = (p[len] == '\0' || p[len] == ',' || p[len] == ' ');
+        if(start_ok && end_ok) { return true; }
+        p += len;
+    }
+    return false;
+}
+
+/**
+ * returns a new spec (allocated from the pool) with the filter added (to the end) or removed
+ **/
+char *ivs_filter_spec_toggle(const char *spec, const char *name, uint8_t on, switch_memory_pool_t *pool) {
+    char *names[IVS_FILTER_CHAIN_MAX] = { 0 };
+    char *spec_dup = NULL, *result = NULL;
+    int names_count = 0;
+
+    if(on) {
+        if(ivs_filter_spec_has(spec, name)) { return switch_core_strdup(pool, spec); }
+        return (zstr(spec) ? switch_core_strdup(pool, name) : switch_core_sprintf(pool, "%s,%s", spec, name));
+    }
+
+    if(zstr(spec)) {
+        return NULL;
+    }
+
+    spec_dup = switch_core_strdup(pool, spec);
+    names_count = switch_separate_string(spec_dup, ',', names, (sizeof(names) / sizeof(names[0])));
+
+    for(int i = 0; i < names_count; i++) {
+        char *item = switch_strip_whitespace(names[i]);
+        if(!zstr(item) && strcmp(item, name)) {
+            result = (result ? switch_core_sprintf(pool, "%s,%s", result, item) : switch_core_strdup(pool, item));
+        }
+        switch_safe_free(item);
+    }
+
+    return result;
+}
@@ -0,0 +1,56 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#ifndef IVS_FILTERS_H
+#define IVS_FILTERS_H
+
+#include <mod_ivs.h>
+
+#define IVS_FILTER_CHAIN_MAX            8
+#define IVS_FILTER_HIST_BINS            12      // <1us, <2us, ... <1024us, >=1024us
+
+/**
+ * a filter works in place on the decoded frames (L16, the codec rate and channels),
+ * the frame length can't be changed, stages just hand the same buffer over to each other.
+ **/
+typedef struct {
+    const char      *name;
+    switch_status_t (*init)(void **ctx, ivs_session_t *ivs_session, switch_memory_pool_t *pool);
+    void            (*process)(void *ctx, int16_t *data, uint32_t samples);
+    void            (*destroy)(void *ctx);                                              // optional
+    void            (*stats)(void *ctx, switch_stream_handle_t *stream);                // optional
+} ivs_audio_filter_t;
+
+typedef struct {
+    const ivs_audio_filter_t *filter;
+    switch_memory_pool_t    *pool;          // own one, goes away with the stage
+    void                    *ctx;
+    uint64_t                frames;
+    uint64_t                cost_ns;
+    uint64_t                cost_max_ns;
+    uint64_t                hist[IVS_FILTER_HIST_BINS];
+} ivs_filter_stage_t;
+
+struct ivs_filter_chain_s {
+    switch_memory_pool_t    *pool;
+    ivs_filter_stage_t      stages[IVS_FILTER_CHAIN_MAX];
+    uint32_t                stages_count;
+};
+
+switch_status_t ivs_audio_filters_init(switch_memory_pool_t *pool);
+void ivs_audio_filters_shutdown();
+switch_status_t ivs_audio_filter_register(const ivs_audio_filter_t *filter);
+const ivs_audio_filter_t *ivs_audio_filter_lookup(const char *name);
+
+switch_status_t ivs_filter_chain_create(ivs_filter_chain_t **chain, ivs_session_t *ivs_session, const char *spec);
+switch_status_t ivs_filter_chain_update(ivs_filter_chain_t **chain, ivs_session_t *ivs_session, const char *spec);
+void ivs_filter_chain_destroy(ivs_filter_chain_t **chain);
+void ivs_filter_chain_process(ivs_filter_chain_t *chain, int16_t *data, uint32_t samples);
+void ivs_filter_chain_stats(ivs_filter_chain_t *chain, switch_stream_handle_t *stream);
+
+uint8_t ivs_filter_spec_has(const char *spec, const char *name);
+char *ivs_filter_spec_toggle(const char *spec, const char *name, uint8_t on, switch_memory_pool_t *pool);
+
+
+#endif
@@ -3,6 +3,9 @@
  * https://github.com/akscf/
  **/
 #include <ivs_playback.h>
+#include <ivs_chunk_store.h>
+#include <ivs_dtmf.h>
+#include <ivs_events.h>
 
 extern globals_t globals;
 
@@ -36,10 +39,14 @@ static void *SWITCH_THREAD_FUNC playback_async_thread(switch_thread_t *thread, v
 static switch_status_t read_frame_callback(switch_core_session_t *session, switch_frame_t *frame, void *user_data) {
     switch_channel_t *channel = switch_core_session_get_channel(session);
     ivs_session_t *ivs_session = (ivs_session_t *) user_data;
-    xdata_buffer_t *audio_buffer = NULL;
 
     if(frame && frame->datalen > 0) {
-        xdata_buffer_push(ivs_session->au_q_in, frame->data, frame->datalen, ivs_session->samplerate, ivs_session->channels);
+        audio_ring_write(ivs_session->au_ring_in, frame->data, frame->datalen);
+    }
+
+    // barge-in (set by the media loop)
+    if(ivs_session_xflags_test(ivs_session, IVS_SF_BARGE_IN)) {
+        return SWITCH_STATUS_BREAK;
     }
 
     return SWITCH_STATUS_SUCCESS;
@@ -51,10 +58,17 @@ static switch_status_t on_dtmf_callback(switch_core_session_t *session, void *in
     switch (itype) {
         case SWITCH_INPUT_TYPE_DTMF: {
                 switch_dtmf_t *dtmf = (switch_dtmf_t *) input;
-                //
-                // todo
-                //
-                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "on_dtmf_callback: digit=%c\n", dtmf->digit);
+
+                ivs_dtmf_process(ivs_session, dtmf);
+
+                // a key press interrupts the prompt as well (same signal as the vad barge-in)
+                if(ivs_session->fl_barge_in) {
+                    if(!ivs_session_xflags_test(ivs_session, IVS_SF_BARGE_IN)) {
+                        ivs_session_xflags_set(ivs_session, IVS_SF_BARGE_IN, true);
+                        ivs_event_push_simple(IVS_EVENTSQ(ivs_session), IVS_EVENT_BARGE_IN, NULL);
+                    }
+                    return SWITCH_STATUS_BREAK;
+                }
             }
             break;
         default:
@@ -67,7 +81,6 @@ static switch_status_t on_dtmf_callback(switch_core_session_t *session, void *in
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------
 switch_status_t ivs_playback_stop(ivs_session_t *ivs_session) {
     switch_status_t  status = SWITCH_STATUS_SUCCESS;
-    int x = 0;
 
     switch_assert(ivs_session);
 
@@ -76,18 +89,13 @@ switch_status_t ivs_playback_stop(ivs_session_t *ivs_session) {
 
             switch_channel_set_flag(switch_core_session_get_channel(ivs_session->session), CF_BREAK);
 
-            while(ivs_session_xflags_test(ivs_session, IVS_SF_PLAYBACK)) {
-                if(globals.fl_shutdown || ivs_session->fl_destroyed) { break; }
-                if(x > 500) {
-                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Couldn't stop playback (session: %s)\n", ivs_session->session_id);
-                    status = SWITCH_STATUS_FALSE;
-                    break;
-                }
-                x++;
-                switch_yield(10000);
+            if((status = ivs_session_xflags_wait(ivs_session, IVS_SF_PLAYBACK, false, 5000)) == SWITCH_STATUS_TIMEOUT) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Couldn't stop playback (session: %s)\n", ivs_session->session_id);
+                status = SWITCH_STATUS_FALSE;
+            } else {
+                status = SWITCH_STATUS_SUCCESS;
             }
         }
-        done:
         ivs_session_release(ivs_session);
     }
 
@@ -165,6 +173,7 @@ switch_status_t ivs_say(ivs_session_t *ivs_session, char *language, char *text,
             }
         }
 
+        ivs_session_xflags_set(ivs_session, IVS_SF_BARGE_IN, false);
         ivs_session_xflags_set(ivs_session, IVS_SF_PLAYBACK, true);
 
         if(switch_channel_test_flag(channel, CF_BREAK)) {
@@ -204,6 +213,9 @@ switch_status_t ivs_playback(ivs_session_t *ivs_session, char *path, uint8_t asy
     const char *engine = NULL;
     const char *language_local = NULL;
     char *expanded = NULL;
+    char *chunk_path = NULL;
+    const char *fpath = NULL;
+    uint8_t fl_chunk = false;
 
     switch_assert(ivs_session);
 
@@ -253,13 +265,19 @@ switch_status_t ivs_playback(ivs_session_t *ivs_session, char *path, uint8_t asy
             expanded = NULL;
         }
 
+        // chunk store files are kept until playback finished (memfd ones are played through the fd, the format goes as the prefix)
+        if((fl_chunk = ivs_chunk_store_take_playback(ivs_session->session_id, path, &fpath))) {
+            chunk_path = path;
+            path = (char *)fpath;
+        }
+
         if(ivs_session_xflags_test(ivs_session, IVS_SF_PLAYBACK)) {
             if((status = ivs_playback_stop(ivs_session)) != SWITCH_STATUS_SUCCESS) {
-                ivs_session_release(ivs_session);
-                goto out;
+                goto release;
             }
         }
 
+        ivs_session_xflags_set(ivs_session, IVS_SF_BARGE_IN, false);
         ivs_session_xflags_set(ivs_session, IVS_SF_PLAYBACK, true);
 
         if(switch_channel_test_flag(channel, CF_BREAK)) {
@@ -293,10 +311,14 @@ switch_status_t ivs_playback(ivs_session_t *ivs_session, char *path, uint8_t asy
         }
 
         ivs_session_xflags_set(ivs_session, IVS_SF_PLAYBACK, false);
+release:
+        // before the release, the session_id belongs to the session
+        if(fl_chunk) {
+            ivs_chunk_store_done(ivs_session->session_id, chunk_path);
+        }
         ivs_session_release(ivs_session);
     }
 
-out:
     switch_safe_free(expanded);
     return status;
 }
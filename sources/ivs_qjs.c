@@ -7,6 +7,7 @@
 #include "ivs_playback.h"
 #include "ivs_events.h"
 #include "ivs_qjs.h"
+#include "ivs_chunk_store.h"
 
 extern globals_t globals;
 
@@ -506,7 +507,7 @@ static JSValue js_unlink(JSContext *ctx, JSValueConst this_val, int argc, JSValu
         return JS_ThrowTypeError(ctx, "Invalid argument: filename");
     }
 
-    unlink(path);
+    ivs_chunk_store_unlink(ivs_session->session_id, path);
 
     JS_FreeCString(ctx, path);
     return JS_TRUE;
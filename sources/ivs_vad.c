@@ -0,0 +1,358 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#include <ivs_vad.h>
+#include <time.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IVS_VAD_X86
+#endif
+
+extern globals_t globals;
+
+#define NATIVE_SNR_FACTOR           2.5     // speech when rms > noise_floor * factor (~8dB)
+#define NATIVE_ZCR_NOISE            0.45    // above that a marginal frame is treated as noise
+#define NATIVE_NF_RISE              0.005   // noise floor tracking (slow up / fast down)
+#define NATIVE_NF_FALL              0.100
+#define NATIVE_NF_MIN               8.0
+
+/**
+ * frame features: sum of squares and number of sign changes.
+ * the kernel is picked once (cpu features) and is the only part that depends on the instruction set.
+ **/
+typedef void (vad_kernel_t)(const int16_t *data, uint32_t samples, uint64_t *energy, uint32_t *zc);
+
+static void vad_kernel_scalar(const int16_t *data, uint32_t samples, uint64_t *energy, uint32_t *zc) {
+    uint64_t e = 0;
+    uint32_t z = 0;
+
+    for(uint32_t i = 0; i < samples; i++) {
+        e += (uint64_t)((int32_t)data[i] * (int32_t)data[i]);
+        if(i + 1 < samples && ((data[i] ^ data[i + 1]) < 0)) { z++; }
+    }
+
+    *energy = e;
+    *zc = z;
+}
+
+#ifdef IVS_VAD_X86
+__attribute__((target("sse2")))
+static void vad_kernel_sse2(const int16_t *data, uint32_t samples, uint64_t *energy, uint32_t *zc) {
+    __m128i acc = _mm_setzero_si128(), zero = _mm_setzero_si128();
+    uint64_t e = 0, tmp[2];
+    uint32_t z = 0, i = 0;
+
+    for(; i + 9 <= samples; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(data + i + 1));
+        __m128i sq = _mm_madd_epi16(a, a); // 4 x (a0^2 + a1^2), fits in uint32
+
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+        z += __builtin_popcount(_mm_movemask_epi8(_mm_xor_si128(a, b)) & 0xAAAA);
+    }
+    _mm_storeu_si128((__m128i *)tmp, acc);
+    e = tmp[0] + tmp[1];
+
+    for(; i < samples; i++) {
+        e += (uint64_t)((int32_t)data[i] * (int32_t)data[i]);
+        if(i + 1 < samples && ((data[i] ^ data[i + 1]) < 0)) { z++; }
+    }
+
+    *energy = e;
+    *zc = z;
+}
+
+__attribute__((target("avx2")))
+static void vad_kernel_avx2(const int16_t *data, uint32_t samples, uint64_t *energy, uint32_t *zc) {
+    __m256i acc = _mm256_setzero_si256(), zero = _mm256_setzero_si256();
+    uint64_t e = 0, tmp[4];
+    uint32_t z = 0, i = 0;
+
+    for(; i + 17 <= samples; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+        __m256i sq = _mm256_madd_epi16(a, a);
+
+        acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(sq, zero));
+        acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(sq, zero));
+        z += __builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_xor_si256(a, b)) & 0xAAAAAAAA);
+    }
+    _mm256_storeu_si256((__m256i *)tmp, acc);
+    e = tmp[0] + tmp[1] + tmp[2] + tmp[3];
+
+    for(; i < samples; i++) {
+        e += (uint64_t)((int32_t)data[i] * (int32_t)data[i]);
+        if(i + 1 < samples && ((data[i] ^ data[i + 1]) < 0)) { z++; }
+    }
+
+    *energy = e;
+    *zc = z;
+}
+#endif
+
+/**
+ * multichannel frames are downmixed (average) before the engines, which are fed with mono
+ **/
+typedef void (vad_downmix_t)(const int16_t *data, uint32_t frames, uint32_t channels, int16_t *out);
+
+static void vad_downmix_scalar(const int16_t *data, uint32_t frames, uint32_t channels, int16_t *out) {
+    for(uint32_t i = 0; i < frames; i++) {
+        int32_t acc = 0;
+        for(uint32_t c = 0; c < channels; c++) {
+            acc += data[(i * channels) + c];
+        }
+        out[i] = (int16_t)(acc / (int32_t)channels);
+    }
+}
+
+#ifdef IVS_VAD_X86
+__attribute__((target("sse2")))
+static void vad_downmix_sse2(const int16_t *data, uint32_t frames, uint32_t channels, int16_t *out) {
+    const __m128i ones = _mm_set1_epi16(1);
+    uint32_t i = 0;
+
+    if(channels != 2) {
+        vad_downmix_scalar(data, frames, channels, out);
+        return;
+    }
+
+    // 16 interleaved L/R -> 8 mono: (L + R) pairs with madd, halved and packed back
+    for(; i + 8 <= frames; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(data + (i * 2)));
+        __m128i b = _mm_loadu_si128((const __m128i *)(data + (i * 2) + 8));
+        __m128i sa = _mm_srai_epi32(_mm_madd_epi16(a, ones), 1);
+        __m128i sb = _mm_srai_epi32(_mm_madd_epi16(b, ones), 1);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(sa, sb));
+    }
+    if(i < frames) {
+        vad_downmix_scalar(data + (i * 2), (frames - i), 2, out + i);
+    }
+}
+#endif
+
+static vad_kernel_t *vad_kernel = NULL;
+static vad_downmix_t *vad_downmix = NULL;
+static const char *vad_kernel_name = "scalar";
+
+static void vad_kernel_select() {
+    if(vad_kernel) { return; }
+
+    vad_downmix = vad_downmix_scalar;
+
+#ifdef IVS_VAD_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")) {
+        vad_downmix = vad_downmix_sse2;
+    }
+    if(__builtin_cpu_supports("avx2")) {
+        vad_kernel_name = "avx2";
+        vad_kernel = vad_kernel_avx2;
+        return;
+    }
+    if(__builtin_cpu_supports("sse2")) {
+        vad_kernel_name = "sse2";
+        vad_kernel = vad_kernel_sse2;
+        return;
+    }
+#endif
+    vad_kernel_name = "scalar";
+    vad_kernel = vad_kernel_scalar;
+}
+
+static inline uint64_t vad_now_ns() {
+    struct timespec ts = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+static switch_vad_state_t native_process(ivs_vad_t *vad, int16_t *data, uint32_t samples) {
+    uint64_t energy = 0;
+    uint32_t zc = 0, frame_ms = 0;
+    double rms = 0, zcr = 0, level = 0;
+    uint8_t fl_speech = false;
+
+    if(!samples) {
+        return vad->state;
+    }
+
+    vad_kernel(data, samples, &energy, &zc);
+
+    rms = sqrt((double)energy / samples);
+    zcr = (samples > 1 ? (double)zc / (samples - 1) : 0);
+    frame_ms = (samples * 1000) / vad->samplerate; // mono here
+
+    level = MAX((double)vad->thresh, vad->noise_floor * NATIVE_SNR_FACTOR);
+    fl_speech = (rms > level);
+    if(fl_speech && zcr > NATIVE_ZCR_NOISE && rms < level * 2) {
+        fl_speech = false; // hiss-like, too weak to be trusted
+    }
+
+    // noise floor follows the quiet frames only
+    if(!fl_speech) {
+        double k = (rms < vad->noise_floor ? NATIVE_NF_FALL : NATIVE_NF_RISE);
+        vad->noise_floor += (rms - vad->noise_floor) * k;
+        if(vad->noise_floor < NATIVE_NF_MIN) { vad->noise_floor = NATIVE_NF_MIN; }
+    } else {
+        vad->speech_frames++;
+    }
+
+    if(vad->debug) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "VAD: rms=%.1f, zcr=%.2f, noise_floor=%.1f, level=%.1f, speech=%i, state=%i\n", rms, zcr, vad->noise_floor, level, fl_speech, vad->state);
+    }
+
+    switch(vad->state) {
+        case SWITCH_VAD_STATE_NONE:
+        case SWITCH_VAD_STATE_STOP_TALKING:
+            vad->silence_acc_ms = 0;
+            vad->voice_acc_ms = (fl_speech ? vad->voice_acc_ms + frame_ms : 0);
+            vad->state = (vad->voice_acc_ms >= vad->voice_ms ? SWITCH_VAD_STATE_START_TALKING : SWITCH_VAD_STATE_NONE);
+            break;
+        case SWITCH_VAD_STATE_START_TALKING:
+        case SWITCH_VAD_STATE_TALKING:
+            vad->voice_acc_ms = 0;
+            vad->silence_acc_ms = (fl_speech ? 0 : vad->silence_acc_ms + frame_ms);
+            vad->state = (vad->silence_acc_ms >= vad->silence_ms ? SWITCH_VAD_STATE_STOP_TALKING : SWITCH_VAD_STATE_TALKING);
+            break;
+    }
+
+    return vad->state;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// public
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+switch_status_t ivs_vad_create(ivs_vad_t **vad, uint32_t engine, uint32_t samplerate, uint32_t channels, switch_memory_pool_t *pool) {
+    ivs_vad_t *lvad = NULL;
+
+    switch_assert(pool);
+
+    if((lvad = switch_core_alloc(pool, sizeof(ivs_vad_t))) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        return SWITCH_STATUS_MEMERR;
+    }
+
+    lvad->engine = engine;
+    lvad->samplerate = samplerate;
+    lvad->channels = (channels ? channels : 1);
+
+    vad_kernel_select();
+
+    if(lvad->channels > 1) {
+        lvad->mix_size = (AUDIO_BUFFER_SIZE / sizeof(int16_t));
+        if((lvad->mix = switch_core_alloc(pool, lvad->mix_size * sizeof(int16_t))) == NULL) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+            return SWITCH_STATUS_MEMERR;
+        }
+    }
+
+    if(engine == IVS_VAD_ENGINE_NATIVE) {
+        lvad->state = SWITCH_VAD_STATE_NONE;
+        lvad->thresh = 100;
+        lvad->voice_ms = 200;
+        lvad->silence_ms = 500;
+        lvad->noise_floor = NATIVE_NF_MIN;
+    } else {
+        if((lvad->fs_vad = switch_vad_init(samplerate, 1)) == NULL) {
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_vad_set_mode(lvad->fs_vad, -1);
+    }
+
+    *vad = lvad;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void ivs_vad_destroy(ivs_vad_t **vad) {
+    ivs_vad_t *lvad = (vad ? *vad : NULL);
+
+    if(lvad && lvad->fs_vad) {
+        switch_vad_destroy(&lvad->fs_vad);
+    }
+}
+
+void ivs_vad_set_param(ivs_vad_t *vad, const char *name, int val) {
+    switch_assert(vad);
+
+    if(vad->fs_vad) {
+        switch_vad_set_param(vad->fs_vad, name, val);
+    }
+
+    if(!strcasecmp(name, "debug")) {
+        vad->debug = val;
+    } else if(!strcasecmp(name, "silence_ms")) {
+        vad->silence_ms = val;
+    } else if(!strcasecmp(name, "voice_ms")) {
+        vad->voice_ms = val;
+    } else if(!strcasecmp(name, "thresh")) {
+        vad->thresh = val;
+    }
+}
+
+void ivs_vad_reset(ivs_vad_t *vad) {
+    switch_assert(vad);
+
+    if(vad->fs_vad) {
+        switch_vad_reset(vad->fs_vad);
+        return;
+    }
+
+    vad->state = SWITCH_VAD_STATE_NONE;
+    vad->voice_acc_ms = 0;
+    vad->silence_acc_ms = 0;
+}
+
+switch_vad_state_t ivs_vad_process(ivs_vad_t *vad, int16_t *data, uint32_t samples) {
+    switch_vad_state_t st = SWITCH_VAD_STATE_NONE;
+    uint64_t ts = vad_now_ns(), te = 0;
+
+    // interleaved -> mono
+    if(vad->channels > 1) {
+        samples = MIN((samples / vad->channels), vad->mix_size);
+        vad_downmix(data, samples, vad->channels, vad->mix);
+        data = vad->mix;
+    }
+
+    if(vad->fs_vad) {
+        st = switch_vad_process(vad->fs_vad, data, samples);
+    } else {
+        st = native_process(vad, data, samples);
+    }
+
+    te = vad_now_ns() - ts;
+    vad->frames++;
+    vad->cost_ns += te;
+    if(te > vad->cost_max_ns) { vad->cost_max_ns = te; }
+
+    return st;
+}
+
+void ivs_vad_stats(ivs_vad_t *vad, switch_stream_handle_t *stream) {
+    if(!vad) { return; }
+
+    stream->write_function(stream, "vad-engine: %s (kernel: %s)\n", ivs_vad_engine2name(vad->engine), (vad->engine == IVS_VAD_ENGINE_NATIVE ? vad_kernel_name : "-"));
+    if(vad->channels > 1) {
+        stream->write_function(stream, "vad-channels: %u (downmix: %s)\n", vad->channels, (vad_downmix == vad_downmix_scalar ? "scalar" : "sse2"));
+    }
+    stream->write_function(stream, "vad-frames: %"SWITCH_UINT64_T_FMT" (speech: %"SWITCH_UINT64_T_FMT")\n", vad->frames, vad->speech_frames);
+    stream->write_function(stream, "vad-cost-ns: avg=%"SWITCH_UINT64_T_FMT", max=%"SWITCH_UINT64_T_FMT"\n", (vad->frames ? vad->cost_ns / vad->frames : 0), vad->cost_max_ns);
+    if(vad->engine == IVS_VAD_ENGINE_NATIVE) {
+        stream->write_function(stream, "vad-noise-floor: %.1f\n", vad->noise_floor);
+    }
+}
+
+const char *ivs_vad_engine2name(uint32_t id) {
+    switch(id) {
+        case IVS_VAD_ENGINE_FREESWITCH: return "freeswitch";
+        case IVS_VAD_ENGINE_NATIVE: return "native";
+    }
+    return "unknown";
+}
+
+uint32_t ivs_vad_engine2id(const char *name) {
+    if(zstr(name)) { return IVS_VAD_ENGINE_FREESWITCH; }
+    if(!strcasecmp(name, "native")) { return IVS_VAD_ENGINE_NATIVE; }
+    return IVS_VAD_ENGINE_FREESWITCH;
+}
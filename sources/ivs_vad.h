@@ -0,0 +1,47 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#ifndef IVS_VAD_H
+#define IVS_VAD_H
+
+#include <mod_ivs.h>
+
+#define IVS_VAD_ENGINE_FREESWITCH       0
+#define IVS_VAD_ENGINE_NATIVE           1
+
+struct ivs_vad_s {
+    uint32_t                engine;
+    uint32_t                samplerate;
+    uint32_t                channels;
+    uint8_t                 debug;
+    switch_vad_t            *fs_vad;
+    int16_t                 *mix;           // downmix buffer (channels > 1)
+    uint32_t                mix_size;       // samples
+    // native engine
+    switch_vad_state_t      state;
+    uint32_t                thresh;         // absolute floor (rms)
+    uint32_t                voice_ms;
+    uint32_t                silence_ms;
+    uint32_t                voice_acc_ms;
+    uint32_t                silence_acc_ms;
+    double                  noise_floor;
+    // cost counters
+    uint64_t                frames;
+    uint64_t                speech_frames;
+    uint64_t                cost_ns;
+    uint64_t                cost_max_ns;
+};
+
+switch_status_t ivs_vad_create(ivs_vad_t **vad, uint32_t engine, uint32_t samplerate, uint32_t channels, switch_memory_pool_t *pool);
+void ivs_vad_destroy(ivs_vad_t **vad);
+void ivs_vad_set_param(ivs_vad_t *vad, const char *name, int val);
+void ivs_vad_reset(ivs_vad_t *vad);
+switch_vad_state_t ivs_vad_process(ivs_vad_t *vad, int16_t *data, uint32_t samples);
+void ivs_vad_stats(ivs_vad_t *vad, switch_stream_handle_t *stream);
+
+const char *ivs_vad_engine2name(uint32_t id);
+uint32_t ivs_vad_engine2id(const char *name);
+
+
+#endif
@@ -0,0 +1,200 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#include <ivs_workers.h>
+#include <ivs_chunks.h>
+
+extern globals_t globals;
+
+/**
+ * fixed pool of chunk assembly workers.
+ * the media loop schedules a session when there is something to do, the session goes into the queue of its preferred worker
+ * (or of an idle one when that worker is busy) and idle workers steal from the others before going to sleep.
+ * chunk_sched guarantees that a session sits in at most one queue and is never processed by two workers at once.
+ **/
+typedef struct {
+    switch_queue_t          *queue;
+    uint32_t                id;
+    uint32_t                busy;
+    uint32_t                jobs;
+    uint32_t                steals;
+} ivs_worker_t;
+
+static ivs_worker_t *workers = NULL;
+static uint32_t workers_total = 0;
+static uint32_t workers_rr = 0;
+static uint32_t workers_drops = 0;
+
+static void worker_run(ivs_worker_t *worker, ivs_session_t *ivs_session) {
+    uint32_t st = 0;
+
+    __atomic_store_n(&ivs_session->chunk_sched, IVS_WORKER_SCHED_RUNNING, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&worker->jobs, 1, __ATOMIC_RELAXED);
+
+    while(true) {
+        ivs_chunks_process(ivs_session);
+
+        st = IVS_WORKER_SCHED_RUNNING;
+        if(__atomic_compare_exchange_n(&ivs_session->chunk_sched, &st, IVS_WORKER_SCHED_IDLE, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        // RESCHEDULE: new frames came in while we were busy
+        __atomic_store_n(&ivs_session->chunk_sched, IVS_WORKER_SCHED_RUNNING, __ATOMIC_SEQ_CST);
+    }
+
+    ivs_session_release(ivs_session);
+}
+
+static ivs_session_t *worker_steal(ivs_worker_t *worker) {
+    void *pop = NULL;
+
+    for(uint32_t i = 1; i < workers_total; i++) {
+        ivs_worker_t *victim = &workers[(worker->id + i) % workers_total];
+        if(switch_queue_trypop(victim->queue, &pop) == SWITCH_STATUS_SUCCESS && pop) {
+            __atomic_add_fetch(&worker->steals, 1, __ATOMIC_RELAXED);
+            return (ivs_session_t *)pop;
+        }
+    }
+
+    return NULL;
+}
+
+static void *SWITCH_THREAD_FUNC worker_thread(switch_thread_t *thread, void *obj) {
+    volatile ivs_worker_t *_ref = (ivs_worker_t *) obj;
+    ivs_worker_t *worker = (ivs_worker_t *) _ref;
+    void *pop = NULL;
+
+    while(!globals.fl_shutdown) {
+        pop = NULL;
+
+        if(switch_queue_trypop(worker->queue, &pop) != SWITCH_STATUS_SUCCESS) {
+            if((pop = worker_steal(worker)) == NULL) {
+                __atomic_store_n(&worker->busy, false, __ATOMIC_RELAXED);
+                if(switch_queue_pop_timeout(worker->queue, &pop, IVS_WORKER_IDLE_TIMEOUT_US) != SWITCH_STATUS_SUCCESS) {
+                    pop = NULL;
+                }
+            }
+        }
+        if(pop) {
+            __atomic_store_n(&worker->busy, true, __ATOMIC_RELAXED);
+            worker_run(worker, (ivs_session_t *)pop);
+        }
+    }
+
+    // drop what is left
+    while(switch_queue_trypop(worker->queue, &pop) == SWITCH_STATUS_SUCCESS) {
+        ivs_session_t *ivs_session = (ivs_session_t *)pop;
+        if(ivs_session) {
+            __atomic_store_n(&ivs_session->chunk_sched, IVS_WORKER_SCHED_IDLE, __ATOMIC_SEQ_CST);
+            ivs_session_release(ivs_session);
+        }
+    }
+
+    thread_finished();
+    return NULL;
+}
+
+static switch_status_t worker_push(ivs_session_t *ivs_session) {
+    ivs_worker_t *worker = &workers[ivs_session->chunk_worker % workers_total];
+
+    if(__atomic_load_n(&worker->busy, __ATOMIC_RELAXED)) {
+        for(uint32_t i = 1; i < workers_total; i++) {
+            ivs_worker_t *tw = &workers[(worker->id + i) % workers_total];
+            if(!__atomic_load_n(&tw->busy, __ATOMIC_RELAXED)) { worker = tw; break; }
+        }
+    }
+    if(switch_queue_trypush(worker->queue, ivs_session) == SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+    for(uint32_t i = 1; i < workers_total; i++) {
+        if(switch_queue_trypush(workers[(worker->id + i) % workers_total].queue, ivs_session) == SWITCH_STATUS_SUCCESS) {
+            return SWITCH_STATUS_SUCCESS;
+        }
+    }
+
+    return SWITCH_STATUS_FALSE;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// public
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+switch_status_t ivs_workers_start(switch_memory_pool_t *pool, uint32_t count) {
+    switch_assert(pool);
+
+    if(!count) {
+        count = switch_core_cpu_count();
+        if(!count) { count = 1; }
+    }
+
+    if((workers = switch_core_alloc(pool, sizeof(ivs_worker_t) * count)) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        return SWITCH_STATUS_MEMERR;
+    }
+
+    for(uint32_t i = 0; i < count; i++) {
+        workers[i].id = i;
+        if(switch_queue_create(&workers[i].queue, IVS_WORKER_QUEUE_SIZE, pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+            return SWITCH_STATUS_MEMERR;
+        }
+    }
+
+    workers_total = count;
+    for(uint32_t i = 0; i < count; i++) {
+        launch_thread(pool, worker_thread, &workers[i]);
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Chunk workers started (%u)\n", count);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void ivs_workers_attach(ivs_session_t *ivs_session) {
+    switch_assert(ivs_session);
+
+    ivs_session->chunk_sched = IVS_WORKER_SCHED_IDLE;
+    ivs_session->chunk_worker = __atomic_fetch_add(&workers_rr, 1, __ATOMIC_RELAXED);
+}
+
+void ivs_workers_schedule(ivs_session_t *ivs_session) {
+    uint32_t st = 0;
+
+    if(!ivs_session || !workers_total || globals.fl_shutdown) {
+        return;
+    }
+
+    while(true) {
+        st = __atomic_load_n(&ivs_session->chunk_sched, __ATOMIC_ACQUIRE);
+        if(st == IVS_WORKER_SCHED_IDLE) {
+            if(__atomic_compare_exchange_n(&ivs_session->chunk_sched, &st, IVS_WORKER_SCHED_SCHEDULED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+        } else if(st == IVS_WORKER_SCHED_RUNNING) {
+            if(__atomic_compare_exchange_n(&ivs_session->chunk_sched, &st, IVS_WORKER_SCHED_RESCHEDULE, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return;
+            }
+        } else {
+            return; // already queued or will be rerun
+        }
+    }
+
+    // the queued session holds a reference until a worker is done with it
+    if(!ivs_session_take(ivs_session)) {
+        __atomic_store_n(&ivs_session->chunk_sched, IVS_WORKER_SCHED_IDLE, __ATOMIC_SEQ_CST);
+        return;
+    }
+    if(worker_push(ivs_session) != SWITCH_STATUS_SUCCESS) {
+        __atomic_add_fetch(&workers_drops, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&ivs_session->chunk_sched, IVS_WORKER_SCHED_IDLE, __ATOMIC_SEQ_CST);
+        ivs_session_release(ivs_session);
+    }
+}
+
+void ivs_workers_stats(switch_stream_handle_t *stream) {
+    stream->write_function(stream, "chunk-workers: %u (drops: %u)\n", workers_total, __atomic_load_n(&workers_drops, __ATOMIC_RELAXED));
+    for(uint32_t i = 0; i < workers_total; i++) {
+        stream->write_function(stream, "worker-%u [busy: %u / jobs: %u / steals: %u / queued: %u]\n",
+            i, workers[i].busy, workers[i].jobs, workers[i].steals, switch_queue_size(workers[i].queue)
+        );
+    }
+}
@@ -0,0 +1,24 @@
+/**
+ * (C)2023 aks
+ * https://github.com/akscf/
+ **/
+#ifndef IVS_WORKERS_H
+#define IVS_WORKERS_H
+
+#include <mod_ivs.h>
+
+#define IVS_WORKER_QUEUE_SIZE           4096
+#define IVS_WORKER_IDLE_TIMEOUT_US      100000
+
+#define IVS_WORKER_SCHED_IDLE           0x0
+#define IVS_WORKER_SCHED_SCHEDULED      0x1
+#define IVS_WORKER_SCHED_RUNNING        0x2
+#define IVS_WORKER_SCHED_RESCHEDULE     0x3 // running and got new work meanwhile
+
+switch_status_t ivs_workers_start(switch_memory_pool_t *pool, uint32_t count);
+void ivs_workers_attach(ivs_session_t *ivs_session);
+void ivs_workers_schedule(ivs_session_t *ivs_session);
+void ivs_workers_stats(switch_stream_handle_t *stream);
+
+
+#endif
@@ -5,6 +5,8 @@
 #include "ivs_qjs.h"
 #include "ivs_events.h"
 #include "ivs_curl.h"
+#include "js_ivs_hlp.h"
+#include "ivs_chunk_store.h"
 
 #define CLASS_NAME              "ChatGPT"
 #define PROP_APIKEY             0
@@ -161,9 +163,6 @@ static void *SWITCH_THREAD_FUNC nlp_request_async_thread(switch_thread_t *thread
     if(res) {
         if(ivs_event_push_nlp2(IVS_EVENTSQ(chatgpt_conf->ivs_session_ref), chatgpt_conf->jid, res) != SWITCH_STATUS_SUCCESS) {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to emit event\n");
-
-            ivs_event_payload_nlp_free(res);
-            switch_safe_free(res);
         }
     } else {
         if(chatgpt_conf->curl_conf->http_error != 200) {
@@ -233,7 +232,7 @@ static ivs_event_payload_transcription_t *whisper_request_exec(chatgpt_conf_t *c
     }
     if(chatgpt_conf->fl_delete_file) {
         if(chatgpt_conf->file_to_send) {
-            unlink(chatgpt_conf->file_to_send);
+            ivs_chunk_store_unlink(chatgpt_conf->ivs_session_ref->session_id, chatgpt_conf->file_to_send);
         }
     }
     return result;
@@ -248,9 +247,6 @@ static void *SWITCH_THREAD_FUNC whisper_request_async_thread(switch_thread_t *th
     if(res) {
         if(ivs_event_push_transcription2(IVS_EVENTSQ(chatgpt_conf->ivs_session_ref), chatgpt_conf->jid, res) != SWITCH_STATUS_SUCCESS) {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to emit event\n");
-
-            ivs_event_payload_transcription_free(res);
-            switch_safe_free(res);
         }
     } else {
         if(chatgpt_conf->curl_conf->http_error != 200) {
@@ -521,13 +517,18 @@ out:
 }
 
 
-// aksWhisper(filename, deleteFileFlag, asyncFlag);
+// aksWhisper(filename | arrayBuffer, deleteFileFlag, asyncFlag, [encoding]);
+// encoding: buffers only, what the buffer holds (event.data.encoding), one of: wav, mp3, opus, flac
 static JSValue js_chatgpt_do_whisper_request(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
     js_chatgpt_t *js_chatgpt = JS_GetOpaque2(ctx, this_val, js_chatgpt_get_classid(ctx));
     ivs_session_t *ivs_session = JS_GetRuntimeOpaque(JS_GetRuntime(ctx));
     switch_status_t status = SWITCH_STATUS_SUCCESS;
     chatgpt_conf_t *chatgpt_conf = NULL;
     const char *file_to_send = NULL;
+    const char *encoding_str = NULL;
+    uint8_t *abuf = NULL;
+    switch_size_t abuf_len = 0;
+    uint32_t encoding = IVS_CHUNK_ENCODING_NONE;
     int fl_async = false, fl_delete = false;
     JSValue ret_obj = JS_UNDEFINED;
 
@@ -541,7 +542,29 @@ static JSValue js_chatgpt_do_whisper_request(JSContext *ctx, JSValueConst this_v
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid argument: filename\n");
             goto out;
         }
-        file_to_send = JS_ToCString(ctx, argv[0]);
+        if(JS_IsString(argv[0])) {
+            file_to_send = JS_ToCString(ctx, argv[0]);
+        } else {
+            // chunk encoded in memory (chunkType = 'buffer')
+            if((abuf = JS_GetArrayBuffer(ctx, &abuf_len, argv[0])) == NULL) {
+                return JS_EXCEPTION;
+            }
+            if(!abuf_len) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid argument: buffer\n");
+                switch_goto_status(SWITCH_STATUS_FALSE, out);
+            }
+            // the name goes to the api and tells it the format, only containers are accepted
+            if(argc > 3 && JS_IsString(argv[3])) {
+                if((encoding_str = JS_ToCString(ctx, argv[3])) == NULL) {
+                    return JS_EXCEPTION;
+                }
+                encoding = ivs_chunkEncoding2id(encoding_str);
+                JS_FreeCString(ctx, encoding_str);
+            }
+            if(encoding != IVS_CHUNK_ENCODING_WAV && encoding != IVS_CHUNK_ENCODING_MP3 && encoding != IVS_CHUNK_ENCODING_OPUS && encoding != IVS_CHUNK_ENCODING_FLAC) {
+                return JS_ThrowTypeError(ctx, "Invalid argument: encoding (wav, mp3, opus or flac expected)");
+            }
+        }
     }
     if(argc > 1) {
         fl_delete = JS_ToBool(ctx, argv[1]);
@@ -550,7 +573,7 @@ static JSValue js_chatgpt_do_whisper_request(JSContext *ctx, JSValueConst this_v
         fl_async = JS_ToBool(ctx, argv[2]);
     }
 
-    if((status = switch_file_exists(file_to_send, NULL)) != SWITCH_STATUS_SUCCESS) {
+    if(!abuf && !ivs_chunk_store_exists(ivs_session->session_id, file_to_send) && (status = switch_file_exists(file_to_send, NULL)) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "File not found: %s\n", file_to_send);
         goto out;
     }
@@ -560,8 +583,9 @@ static JSValue js_chatgpt_do_whisper_request(JSContext *ctx, JSValueConst this_v
     }
 
     chatgpt_conf->ivs_session_ref = ivs_session;
-    chatgpt_conf->file_to_send = switch_core_strdup(chatgpt_conf->pool, file_to_send);
-    chatgpt_conf->fl_delete_file = fl_delete;
+    chatgpt_conf->curl_conf->session_id = ivs_session->session_id;
+    chatgpt_conf->file_to_send = safe_pool_strdup(chatgpt_conf->pool, file_to_send);
+    chatgpt_conf->fl_delete_file = (abuf ? false : fl_delete);
     chatgpt_conf->fl_log_http_errors = js_chatgpt->fl_log_http_errors;
 
     chatgpt_conf->curl_conf->url = CHATGPT_WHISPER_URL;
@@ -573,7 +597,12 @@ static JSValue js_chatgpt_do_whisper_request(JSContext *ctx, JSValueConst this_v
     chatgpt_conf->curl_conf->user_agent = safe_pool_strdup(chatgpt_conf->pool, js_chatgpt->user_agent);
 
     curl_field_add(chatgpt_conf->curl_conf, CURL_FIELD_TYPE_SIMPLE, "model", js_chatgpt->whisper_model);
-    curl_field_add(chatgpt_conf->curl_conf, CURL_FIELD_TYPE_FILE, "file", (char *)file_to_send);
+    if(abuf) {
+        char *fname = switch_core_sprintf(chatgpt_conf->pool, "chunk.%s", ivs_chunkEncoding2ext(encoding));
+        curl_field_add_buffer(chatgpt_conf->curl_conf, "file", fname, abuf, abuf_len);
+    } else {
+        curl_field_add(chatgpt_conf->curl_conf, CURL_FIELD_TYPE_FILE, "file", (char *)file_to_send);
+    }
 
     if(fl_async) {
         uint32_t jid = whisper_request_exec_async(chatgpt_conf);
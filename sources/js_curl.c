@@ -115,9 +115,6 @@ static void *SWITCH_THREAD_FUNC js_curl_request_exec_thread(switch_thread_t *thr
     if(res) {
         if(ivs_event_push_curl2(IVS_EVENTSQ(creq_conf->ivs_session_ref), creq_conf->jid, res) != SWITCH_STATUS_SUCCESS) {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to emit event\n");
-
-            ivs_event_payload_curl_free(res);
-            switch_safe_free(res);
         }
     }
 
@@ -398,7 +395,7 @@ static JSValue js_curl_property_set(JSContext *ctx, JSValueConst this_val, JSVal
 }
 
 /**
- ** perform( [string|arrayBuffer] || {type: [file|simple], name: fieldName, value: fieldValue}, {...})
+ ** perform( [string|arrayBuffer] || {type: [file|simple|buffer], name: fieldName, value: fieldValue, [filename: name (buffer)]}, {...})
  **/
 static JSValue js_curl_perform_request(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
     js_curl_t *js_curl = JS_GetOpaque2(ctx, this_val, js_curl_get_classid(ctx));
@@ -420,6 +417,7 @@ static JSValue js_curl_perform_request(JSContext *ctx, JSValueConst this_val, in
     if((status = js_creq_conf_alloc(&creq_conf)) != SWITCH_STATUS_SUCCESS) {
         switch_goto_status(SWITCH_STATUS_GENERR, out);
     }
+    creq_conf->curl_conf->session_id = ivs_session->session_id;
 
     if(argc > 0) {
         for(int i = 0; i < argc; i++) {
@@ -452,9 +450,20 @@ static JSValue js_curl_perform_request(JSContext *ctx, JSValueConst this_val, in
                         const char *ftype = NULL, *fname = NULL, *fval = NULL;
                         ftype = JS_ToCString(ctx, field_type);
                         fname = JS_ToCString(ctx, field_name);
-                        fval = JS_ToCString(ctx, field_value);
 
-                        status = curl_field_add(creq_conf->curl_conf, (!strcasecmp(ftype, "file") ? CURL_FIELD_TYPE_FILE : CURL_FIELD_TYPE_SIMPLE), (char *)fname, (char *)fval);
+                        if(!strcasecmp(ftype, "buffer")) {
+                            // { type: 'buffer', name: 'file', value: ArrayBuffer, filename: 'chunk.wav' }
+                            JSValue field_filename = JS_GetPropertyStr(ctx, argv[i], "filename");
+                            switch_size_t fbuf_len = 0;
+                            uint8_t *fbuf = JS_GetArrayBuffer(ctx, &fbuf_len, field_value);
+
+                            fval = (JS_IsString(field_filename) ? JS_ToCString(ctx, field_filename) : NULL);
+                            status = curl_field_add_buffer(creq_conf->curl_conf, (char *)fname, (char *)(fval ? fval : fname), fbuf, fbuf_len);
+                            JS_FreeValue(ctx, field_filename);
+                        } else {
+                            fval = JS_ToCString(ctx, field_value);
+                            status = curl_field_add(creq_conf->curl_conf, (!strcasecmp(ftype, "file") ? CURL_FIELD_TYPE_FILE : CURL_FIELD_TYPE_SIMPLE), (char *)fname, (char *)fval);
+                        }
 
                         JS_FreeCString(ctx, ftype);
                         JS_FreeCString(ctx, fname);
@@ -522,6 +531,7 @@ static JSValue js_curl_perform_request_async(JSContext *ctx, JSValueConst this_v
     if((status = js_creq_conf_alloc(&creq_conf)) != SWITCH_STATUS_SUCCESS) {
         switch_goto_status(SWITCH_STATUS_GENERR, out);
     }
+    creq_conf->curl_conf->session_id = ivs_session->session_id;
 
     if(argc > 0) {
         for(int i = 0; i < argc; i++) {
@@ -554,9 +564,20 @@ static JSValue js_curl_perform_request_async(JSContext *ctx, JSValueConst this_v
                         const char *ftype = NULL, *fname = NULL, *fval = NULL;
                         ftype = JS_ToCString(ctx, field_type);
                         fname = JS_ToCString(ctx, field_name);
-                        fval = JS_ToCString(ctx, field_value);
 
-                        status = curl_field_add(creq_conf->curl_conf, (!strcasecmp(ftype, "file") ? CURL_FIELD_TYPE_FILE : CURL_FIELD_TYPE_SIMPLE), (char *)fname, (char *)fval);
+                        if(!strcasecmp(ftype, "buffer")) {
+                            // { type: 'buffer', name: 'file', value: ArrayBuffer, filename: 'chunk.wav' }
+                            JSValue field_filename = JS_GetPropertyStr(ctx, argv[i], "filename");
+                            switch_size_t fbuf_len = 0;
+                            uint8_t *fbuf = JS_GetArrayBuffer(ctx, &fbuf_len, field_value);
+
+                            fval = (JS_IsString(field_filename) ? JS_ToCString(ctx, field_filename) : NULL);
+                            status = curl_field_add_buffer(creq_conf->curl_conf, (char *)fname, (char *)(fval ? fval : fname), fbuf, fbuf_len);
+                            JS_FreeValue(ctx, field_filename);
+                        } else {
+                            fval = JS_ToCString(ctx, field_value);
+                            status = curl_field_add(creq_conf->curl_conf, (!strcasecmp(ftype, "file") ? CURL_FIELD_TYPE_FILE : CURL_FIELD_TYPE_SIMPLE), (char *)fname, (char *)fval);
+                        }
 
                         JS_FreeCString(ctx, ftype);
                         JS_FreeCString(ctx, fname);
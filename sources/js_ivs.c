@@ -5,6 +5,12 @@
 #include "ivs_qjs.h"
 #include "js_ivs_hlp.h"
 #include "js_ivs_wrp.h"
+#include "ivs_chunk_store.h"
+#include "ivs_chunk_enc.h"
+#include "ivs_filters.h"
+#include "ivs_dtmf.h"
+
+extern globals_t globals;
 
 #define CLASS_NAME                  "IVS"
 #define PROP_SID                    0
@@ -14,6 +20,17 @@
 #define PROP_VAD_STATE              4
 #define PROP_CHUNK_TYPE             5
 #define PROP_CHUNK_ENCODING         6
+#define PROP_CHUNK_MODE             7
+#define PROP_CHUNK_SAMPLERATE       8
+#define PROP_BARGE_IN               9
+#define PROP_NOISE_SUPPRESSION      10
+#define PROP_CHUNK_COMPACT          11
+#define PROP_CHUNK_LENGTH           12
+#define PROP_VAD_SILENCE_MS         13
+#define PROP_VAD_VOICE_MS           14
+#define PROP_VAD_THRESHOLD          15
+#define PROP_VAD_ADAPTIVE           16
+#define PROP_EXPECT_SHORT_ANSWER    17
 
 #define IVS_SESSION_SANITY_CHECK() if (!js_ivs || !js_ivs->session) { \
            return JS_ThrowTypeError(ctx, "Session is not initialized"); \
@@ -51,6 +68,43 @@ static JSValue js_ivs_property_get(JSContext *ctx, JSValueConst this_val, int ma
         case PROP_CHUNK_ENCODING: {
             return JS_NewString(ctx, ivs_chunkEncoding2name(ivs_session->chunk_encoding));
         }
+        case PROP_CHUNK_MODE: {
+            return JS_NewString(ctx, ivs_chunkMode2name(ivs_session->chunk_mode));
+        }
+        case PROP_CHUNK_SAMPLERATE: {
+            return JS_NewInt32(ctx, (ivs_session->chunk_samplerate ? ivs_session->chunk_samplerate : ivs_session->samplerate));
+        }
+        case PROP_BARGE_IN: {
+            return (ivs_session->fl_barge_in ? JS_TRUE : JS_FALSE);
+        }
+        case PROP_CHUNK_COMPACT: {
+            return (ivs_session->fl_chunk_compact ? JS_TRUE : JS_FALSE);
+        }
+        case PROP_CHUNK_LENGTH: {
+            return JS_NewInt32(ctx, ivs_session->chunk_len_sec);
+        }
+        case PROP_VAD_SILENCE_MS: {
+            return JS_NewInt32(ctx, ivs_session->vad_silence_ms);
+        }
+        case PROP_VAD_VOICE_MS: {
+            return JS_NewInt32(ctx, ivs_session->vad_voice_ms);
+        }
+        case PROP_VAD_THRESHOLD: {
+            return JS_NewInt32(ctx, ivs_session->vad_threshold);
+        }
+        case PROP_VAD_ADAPTIVE: {
+            return (ivs_session->fl_vad_adaptive ? JS_TRUE : JS_FALSE);
+        }
+        case PROP_EXPECT_SHORT_ANSWER: {
+            return (ivs_session->fl_short_answer ? JS_TRUE : JS_FALSE);
+        }
+        case PROP_NOISE_SUPPRESSION: {
+            uint8_t on = false;
+            switch_mutex_lock(ivs_session->mutex);
+            on = ivs_filter_spec_has(ivs_session->audio_filters, "denoise");
+            switch_mutex_unlock(ivs_session->mutex);
+            return (on ? JS_TRUE : JS_FALSE);
+        }
         case PROP_VAD_STATE: {
             return JS_NewString(ctx, ivs_vadState2name(ivs_session->vad_state));
         }
@@ -127,17 +181,109 @@ static JSValue js_ivs_property_set(JSContext *ctx, JSValueConst this_val, JSValu
             return JS_TRUE;
         }
         case PROP_CHUNK_ENCODING: {
+            if(QJS_IS_NULL(val)) {
+                return JS_FALSE;
+            } else {
+                uint32_t encoding = IVS_CHUNK_ENCODING_NONE;
+
+                if((str = JS_ToCString(ctx, val)) == NULL) {
+                    return JS_EXCEPTION;
+                }
+                encoding = ivs_chunkEncoding2id(str);
+                if(!ivs_chunk_encoding_available(encoding)) {
+                    JSValue err = JS_ThrowRangeError(ctx, "Unsupported chunk encoding: %s", str);
+                    JS_FreeCString(ctx, str);
+                    return err;
+                }
+                switch_mutex_lock(ivs_session->mutex);
+                ivs_session->chunk_encoding = encoding;
+                switch_mutex_unlock(ivs_session->mutex);
+                JS_FreeCString(ctx, str);
+            }
+            return JS_TRUE;
+        }
+        case PROP_CHUNK_MODE: {
             if(QJS_IS_NULL(val)) {
                 return JS_FALSE;
             } else {
                 str = JS_ToCString(ctx, val);
                 switch_mutex_lock(ivs_session->mutex);
-                ivs_session->chunk_encoding = ivs_chunkEncoding2id(str);
+                ivs_session->chunk_mode = ivs_chunkMode2id(str);
                 switch_mutex_unlock(ivs_session->mutex);
                 JS_FreeCString(ctx, str);
             }
             return JS_TRUE;
         }
+        case PROP_CHUNK_SAMPLERATE: {
+            uint32_t rate = 0;
+            if(QJS_IS_NULL(val)) {
+                rate = 0; // codec rate
+            } else {
+                if(JS_ToUint32(ctx, &rate, val)) {
+                    return JS_EXCEPTION;
+                }
+                if(!IVS_CHUNK_SAMPLERATE_VALID(rate)) {
+                    return JS_ThrowRangeError(ctx, "Unsupported chunk samplerate: %u (8000..48000)", rate);
+                }
+            }
+            switch_mutex_lock(ivs_session->mutex);
+            ivs_session->chunk_samplerate = rate;
+            switch_mutex_unlock(ivs_session->mutex);
+            return JS_TRUE;
+        }
+        case PROP_BARGE_IN: {
+            ivs_session->fl_barge_in = JS_ToBool(ctx, val);
+            return JS_TRUE;
+        }
+        case PROP_CHUNK_COMPACT: {
+            switch_mutex_lock(ivs_session->mutex);
+            ivs_session->fl_chunk_compact = JS_ToBool(ctx, val);
+            switch_mutex_unlock(ivs_session->mutex);
+            return JS_TRUE;
+        }
+        case PROP_CHUNK_LENGTH: {
+            uint32_t len_sec = 0;
+            if(JS_ToUint32(ctx, &len_sec, val)) {
+                return JS_EXCEPTION;
+            }
+            if(!len_sec) { return JS_FALSE; }
+            switch_mutex_lock(ivs_session->mutex);
+            ivs_session->chunk_len_sec = len_sec;
+            switch_mutex_unlock(ivs_session->mutex);
+            return JS_TRUE;
+        }
+        case PROP_VAD_SILENCE_MS:
+        case PROP_VAD_VOICE_MS:
+        case PROP_VAD_THRESHOLD: {
+            uint32_t ival = 0;
+            if(JS_ToUint32(ctx, &ival, val)) {
+                return JS_EXCEPTION;
+            }
+            if(!ival) { return JS_FALSE; }
+            switch_mutex_lock(ivs_session->mutex);
+            if(magic == PROP_VAD_SILENCE_MS) { ivs_session->vad_silence_ms = ival; }
+            else if(magic == PROP_VAD_VOICE_MS) { ivs_session->vad_voice_ms = ival; }
+            else { ivs_session->vad_threshold = ival; }
+            ivs_session->fl_vad_changed = true;
+            switch_mutex_unlock(ivs_session->mutex);
+            return JS_TRUE;
+        }
+        case PROP_VAD_ADAPTIVE:
+        case PROP_EXPECT_SHORT_ANSWER: {
+            switch_mutex_lock(ivs_session->mutex);
+            if(magic == PROP_VAD_ADAPTIVE) { ivs_session->fl_vad_adaptive = JS_ToBool(ctx, val); }
+            else { ivs_session->fl_short_answer = JS_ToBool(ctx, val); }
+            ivs_session->fl_vad_changed = true;
+            switch_mutex_unlock(ivs_session->mutex);
+            return JS_TRUE;
+        }
+        case PROP_NOISE_SUPPRESSION: {
+            switch_mutex_lock(ivs_session->mutex);
+            ivs_session->audio_filters = ivs_filter_spec_toggle(ivs_session->audio_filters, "denoise", JS_ToBool(ctx, val), ivs_session->script->pool);
+            ivs_session->fl_filters_changed = true;
+            switch_mutex_unlock(ivs_session->mutex);
+            return JS_TRUE;
+        }
     }
     return JS_FALSE;
 }
@@ -208,8 +354,10 @@ static JSValue js_ivs_playback(JSContext *ctx, JSValueConst this_val, int argc,
         uint32_t jid = js_ivs_async_playback(ivs_session, path, fl_delete);
         ret_val = (jid > 0 ? JS_NewInt32(ctx, jid) : JS_FALSE);
     } else {
+        uint8_t fl_chunk = ivs_chunk_store_take(ivs_session->session_id, path, NULL, NULL, NULL);
         switch_status_t st = ivs_playback(ivs_session, (char *)path, false);
-        if(fl_delete) { unlink(path); }
+        if(fl_delete) { ivs_chunk_store_unlink(ivs_session->session_id, path); }
+        if(fl_chunk) { ivs_chunk_store_done(ivs_session->session_id, path); }
         ret_val = (st == SWITCH_STATUS_SUCCESS ? JS_TRUE : JS_FALSE);
     }
 
@@ -228,117 +376,440 @@ static JSValue js_ivs_playback_stop(JSContext *ctx, JSValueConst this_val, int a
     return JS_TRUE;
 }
 
-static JSValue js_ivs_get_event(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+// collectDigits(maxDigits, [terminators], [timeoutMs]) => 'dtmf-collected' event
+static JSValue js_ivs_collect_digits(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
     js_ivs_t *js_ivs = JS_GetOpaque2(ctx, this_val, js_ivs_get_classid(ctx));
     ivs_session_t *ivs_session = js_ivs->session;
-    JSValue ret_val = JS_FALSE;
-    JSValue edata_obj = JS_FALSE;
-    uint8_t fl_found = false;
-    void *pop = NULL;
+    const char *terminators = NULL;
+    uint32_t digits_max = 0, timeout_ms = 0;
 
     IVS_SESSION_SANITY_CHECK();
 
-    if(switch_queue_trypop(ivs_session->events, &pop) == SWITCH_STATUS_SUCCESS) {
-        ivs_event_t *event = (ivs_event_t *)pop;
-        if(event) {
-            fl_found = true;
-            ret_val = JS_NewObject(ctx);
-
-            JS_SetPropertyStr(ctx, ret_val, "class",   JS_NewString(ctx, "IvsEvent"));
-            JS_SetPropertyStr(ctx, ret_val, "jid",     JS_NewInt32(ctx, event->jid));
-            switch(event->type) {
-                case IVS_EVENT_NOP: {
-                    JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "nop"));
-                    break;
-                }
-                case IVS_EVENT_SPEAKING_START: {
-                    JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "speaking-start"));
-                    break;
-                }
-                case IVS_EVENT_SPEAKING_STOP: {
-                    JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "speaking-stop"));
-                    break;
-                }
-                case IVS_EVENT_PLAYBACK_STARTED: {
-                    edata_obj = JS_NewObject(ctx);
-                    JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "playback-started"));
-                    JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
-                    JS_SetPropertyStr(ctx, edata_obj, "file", JS_NewStringLen(ctx, event->payload, event->payload_len));
-                    break;
-                }
-                case IVS_EVENT_PLAYBACK_FINISHED: {
-                    edata_obj = JS_NewObject(ctx);
-                    JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "playback-finished"));
-                    JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
-                    JS_SetPropertyStr(ctx, edata_obj, "file", JS_NewStringLen(ctx, event->payload, event->payload_len));
-                    break;
+    if(argc < 1) {
+        return JS_ThrowTypeError(ctx, "Invalid arguments");
+    }
+
+    if(JS_ToUint32(ctx, &digits_max, argv[0])) {
+        return JS_EXCEPTION;
+    }
+    if(argc > 2 && !QJS_IS_NULL(argv[2])) {
+        if(JS_ToUint32(ctx, &timeout_ms, argv[2])) {
+            return JS_EXCEPTION;
+        }
+    }
+    if(argc > 1 && !QJS_IS_NULL(argv[1])) {
+        if((terminators = JS_ToCString(ctx, argv[1])) == NULL) {
+            return JS_EXCEPTION;
+        }
+    }
+
+    ivs_dtmf_collect_start(ivs_session, digits_max, terminators, timeout_ms);
+
+    if(terminators) {
+        JS_FreeCString(ctx, terminators);
+    }
+
+    return JS_TRUE;
+}
+
+static JSValue js_ivs_collect_digits_stop(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    js_ivs_t *js_ivs = JS_GetOpaque2(ctx, this_val, js_ivs_get_classid(ctx));
+    ivs_session_t *ivs_session = js_ivs->session;
+
+    IVS_SESSION_SANITY_CHECK();
+
+    ivs_dtmf_collect_cancel(ivs_session);
+
+    return JS_TRUE;
+}
+
+static int js_ivs_event_mask_add(JSContext *ctx, JSValueConst val, uint32_t *mask) {
+    const char *name = JS_ToCString(ctx, val);
+    uint32_t type = ivs_eventType2id(name);
+
+    JS_FreeCString(ctx, name);
+    if(type == IVS_EVENT_NOP) {
+        return -1;
+    }
+
+    *mask |= IVS_EVENT_MASK(type);
+    return 0;
+}
+
+// subscribe(['chunk-ready', 'curl-done'] | 'chunk-ready' | null = all), unsubscribe(...)
+// events the script isn't subscribed to are dropped before allocation, all are on by default
+static JSValue js_ivs_subscribe_helper(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, uint8_t fl_subscribe) {
+    js_ivs_t *js_ivs = JS_GetOpaque2(ctx, this_val, js_ivs_get_classid(ctx));
+    uint32_t mask = 0;
+
+    IVS_SESSION_SANITY_CHECK();
+
+    if(argc < 1 || QJS_IS_NULL(argv[0])) {
+        mask = IVS_EVENTS_MASK_ALL;
+    } else if(JS_IsArray(ctx, argv[0])) {
+        uint32_t len = 0;
+        JSValue jlen = JS_GetPropertyStr(ctx, argv[0], "length");
+        int err = JS_ToUint32(ctx, &len, jlen);
+        JS_FreeValue(ctx, jlen);
+        if(err) {
+            return JS_EXCEPTION;
+        }
+
+        for(uint32_t i = 0; i < len; i++) {
+            JSValue item = JS_GetPropertyUint32(ctx, argv[0], i);
+            int err = js_ivs_event_mask_add(ctx, item, &mask);
+            JS_FreeValue(ctx, item);
+            if(err) {
+                return JS_ThrowTypeError(ctx, "Unknown event type");
+            }
+        }
+    } else if(js_ivs_event_mask_add(ctx, argv[0], &mask)) {
+        return JS_ThrowTypeError(ctx, "Unknown event type");
+    }
+
+    ivs_events_subscribe(js_ivs->session->events, mask, fl_subscribe);
+
+    return JS_TRUE;
+}
+
+static JSValue js_ivs_subscribe(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    return js_ivs_subscribe_helper(ctx, this_val, argc, argv, true);
+}
+
+static JSValue js_ivs_unsubscribe(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    return js_ivs_subscribe_helper(ctx, this_val, argc, argv, false);
+}
+
+// setAudioFilters(['echo-gate', 'denoise'] | 'echo-gate,denoise' | null)
+static JSValue js_ivs_set_audio_filters(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    js_ivs_t *js_ivs = JS_GetOpaque2(ctx, this_val, js_ivs_get_classid(ctx));
+    ivs_session_t *ivs_session = js_ivs->session;
+    char *spec = NULL;
+
+    IVS_SESSION_SANITY_CHECK();
+
+    if(argc < 1 || QJS_IS_NULL(argv[0])) {
+        spec = NULL;
+    } else if(JS_IsArray(ctx, argv[0])) {
+        uint32_t len = 0;
+        JSValue jlen = JS_GetPropertyStr(ctx, argv[0], "length");
+        int err = JS_ToUint32(ctx, &len, jlen);
+        JS_FreeValue(ctx, jlen);
+        if(err) {
+            return JS_EXCEPTION;
+        }
+
+        for(uint32_t i = 0; i < len; i++) {
+            JSValue item = JS_GetPropertyUint32(ctx, argv[0], i);
+            const char *name = JS_ToCString(ctx, item);
+            if(!zstr(name)) {
+                if(!ivs_audio_filter_lookup(name)) {
+                    JS_FreeCString(ctx, name);
+                    JS_FreeValue(ctx, item);
+                    return JS_ThrowTypeError(ctx, "Unknown filter");
                 }
-                case IVS_EVENT_CHUNK_READY: {
-                    ivs_event_payload_mchunk_t *payload = (ivs_event_payload_mchunk_t *)event->payload;
-                    edata_obj = JS_NewObject(ctx);
-                    JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "chunk-ready"));
-                    JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
-
-                    if(payload) {
-                        JS_SetPropertyStr(ctx, edata_obj, "type", JS_NewString(ctx, ivs_chunkType2name(ivs_session->chunk_type)));
-                        JS_SetPropertyStr(ctx, edata_obj, "time", JS_NewInt32(ctx, payload->time));
-                        JS_SetPropertyStr(ctx, edata_obj, "length", JS_NewInt32(ctx, payload->length));
-                        JS_SetPropertyStr(ctx, edata_obj, "samplerate", JS_NewInt32(ctx, payload->samplerate));
-                        JS_SetPropertyStr(ctx, edata_obj, "channels", JS_NewInt32(ctx, payload->channels));
-                        if(ivs_session->chunk_type == IVS_CHUNK_TYPE_FILE) {
-                            JS_SetPropertyStr(ctx, edata_obj, "file", JS_NewStringLen(ctx, payload->data, payload->data_len));
-                        } else if(ivs_session->chunk_type == IVS_CHUNK_TYPE_BUFFER) {
-                            JS_SetPropertyStr(ctx, edata_obj, "buffer", JS_NewArrayBufferCopy(ctx, payload->data, payload->data_len));
+                spec = (spec ? switch_core_sprintf(ivs_session->script->pool, "%s,%s", spec, name) : switch_core_strdup(ivs_session->script->pool, name));
+            }
+            JS_FreeCString(ctx, name);
+            JS_FreeValue(ctx, item);
+        }
+    } else {
+        const char *str = JS_ToCString(ctx, argv[0]);
+        spec = (zstr(str) ? NULL : switch_core_strdup(ivs_session->script->pool, str));
+        JS_FreeCString(ctx, str);
+    }
+
+    switch_mutex_lock(ivs_session->mutex);
+    ivs_session->audio_filters = spec;
+    ivs_session->fl_filters_changed = true;
+    switch_mutex_unlock(ivs_session->mutex);
+
+    return JS_TRUE;
+}
+
+/**
+ * blocks up to timeout_ms (< 0 = no limit) until an event arrives or the session goes down,
+ * the media thread interrupts the queue on its way out, the slices only cover the flags race
+ **/
+#define EVENT_WAIT_SLICE_MS 250
+static switch_status_t ivs_session_event_wait(ivs_session_t *ivs_session, int32_t timeout_ms, void **pop) {
+    switch_time_t deadline = (timeout_ms > 0 ? switch_micro_time_now() + ((switch_time_t)timeout_ms * 1000) : 0);
+    switch_time_t slice = 0;
+
+    if(timeout_ms == 0) {
+        return switch_queue_trypop(ivs_session->events->queue, pop);
+    }
+
+    while(true) {
+        if(globals.fl_shutdown || ivs_session->fl_do_destroy || ivs_session->fl_destroyed || !ivs_session->fl_ready) {
+            break;
+        }
+        if(ivs_session->script && ivs_session->script->fl_interrupt) {
+            break;
+        }
+
+        slice = (EVENT_WAIT_SLICE_MS * 1000);
+        if(deadline) {
+            switch_time_t now = switch_micro_time_now();
+            if(now >= deadline) { break; }
+            slice = MIN(slice, (deadline - now));
+        }
+
+        if(switch_queue_pop_timeout(ivs_session->events->queue, pop, slice) == SWITCH_STATUS_SUCCESS) {
+            return SWITCH_STATUS_SUCCESS;
+        }
+    }
+
+    return SWITCH_STATUS_FALSE;
+}
+
+static void js_ivs_chunk_buffer_free(JSRuntime *rt, void *opaque, void *ptr) {
+    switch_safe_free(ptr);
+}
+
+static JSValue js_ivs_event_to_object(JSContext *ctx, ivs_event_t *event) {
+    JSValue ret_val = JS_FALSE;
+    JSValue edata_obj = JS_FALSE;
+
+    ret_val = JS_NewObject(ctx);
+
+    JS_SetPropertyStr(ctx, ret_val, "class",   JS_NewString(ctx, "IvsEvent"));
+    JS_SetPropertyStr(ctx, ret_val, "jid",     JS_NewInt32(ctx, event->jid));
+    switch(event->type) {
+        case IVS_EVENT_NOP: {
+            JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "nop"));
+            break;
+        }
+        case IVS_EVENT_SPEAKING_START: {
+            JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "speaking-start"));
+            break;
+        }
+        case IVS_EVENT_SPEAKING_STOP: {
+            JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "speaking-stop"));
+            break;
+        }
+        case IVS_EVENT_BARGE_IN: {
+            JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "barge-in"));
+            break;
+        }
+        case IVS_EVENT_PLAYBACK_STARTED: {
+            edata_obj = JS_NewObject(ctx);
+            JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "playback-started"));
+            JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
+            JS_SetPropertyStr(ctx, edata_obj, "file", JS_NewStringLen(ctx, event->payload, event->payload_len));
+            break;
+        }
+        case IVS_EVENT_PLAYBACK_FINISHED: {
+            edata_obj = JS_NewObject(ctx);
+            JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "playback-finished"));
+            JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
+            JS_SetPropertyStr(ctx, edata_obj, "file", JS_NewStringLen(ctx, event->payload, event->payload_len));
+            break;
+        }
+        case IVS_EVENT_CHUNK_READY: {
+            ivs_event_payload_mchunk_t *payload = (ivs_event_payload_mchunk_t *)event->payload;
+            edata_obj = JS_NewObject(ctx);
+            JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "chunk-ready"));
+            JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
+
+            if(payload) {
+                JS_SetPropertyStr(ctx, edata_obj, "type", JS_NewString(ctx, ivs_chunkType2name(payload->type)));
+                JS_SetPropertyStr(ctx, edata_obj, "encoding", JS_NewString(ctx, ivs_chunkEncoding2name(payload->encoding)));
+                JS_SetPropertyStr(ctx, edata_obj, "time", JS_NewInt32(ctx, payload->time));
+                JS_SetPropertyStr(ctx, edata_obj, "length", JS_NewInt32(ctx, payload->length));
+                JS_SetPropertyStr(ctx, edata_obj, "samplerate", JS_NewInt32(ctx, payload->samplerate));
+                JS_SetPropertyStr(ctx, edata_obj, "channels", JS_NewInt32(ctx, payload->channels));
+                JS_SetPropertyStr(ctx, edata_obj, "utterance", JS_NewInt32(ctx, payload->utterance));
+                JS_SetPropertyStr(ctx, edata_obj, "seq", JS_NewInt32(ctx, payload->seq));
+                JS_SetPropertyStr(ctx, edata_obj, "isFinal", JS_NewBool(ctx, payload->final));
+                JS_SetPropertyStr(ctx, edata_obj, "duration", JS_NewInt32(ctx, payload->duration_ms));
+                JS_SetPropertyStr(ctx, edata_obj, "originalDuration", JS_NewInt32(ctx, payload->orig_duration_ms));
+                if(payload->endpoint.timeout_ms) {
+                    JSValue ep_obj = JS_NewObject(ctx);
+                    JSValue reasons_obj = JS_NewArray(ctx);
+                    uint32_t ridx = 0;
+
+                    for(uint32_t r = IVS_EP_REASON_SHORT_ANSWER; r <= IVS_EP_REASON_MAX; r <<= 1) {
+                        if(payload->endpoint.reasons & r) {
+                            JS_SetPropertyUint32(ctx, reasons_obj, ridx++, JS_NewString(ctx, ivs_endpointReason2name(r)));
                         }
                     }
-                    break;
+                    JS_SetPropertyStr(ctx, ep_obj, "timeout", JS_NewInt32(ctx, payload->endpoint.timeout_ms));
+                    JS_SetPropertyStr(ctx, ep_obj, "speech", JS_NewInt32(ctx, payload->endpoint.speech_ms));
+                    JS_SetPropertyStr(ctx, ep_obj, "silence", JS_NewInt32(ctx, payload->endpoint.silence_ms));
+                    JS_SetPropertyStr(ctx, ep_obj, "reasons", reasons_obj);
+                    JS_SetPropertyStr(ctx, edata_obj, "endpoint", ep_obj);
                 }
-                case IVS_EVENT_TRANSCRIPTION_DONE: {
-                    ivs_event_payload_transcription_t *payload = (ivs_event_payload_transcription_t *)event->payload;
-                    edata_obj = JS_NewObject(ctx);
-                    JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "transcription-done"));
-                    JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
-
-                    if(payload) {
-                        JS_SetPropertyStr(ctx, edata_obj, "text", JS_NewString(ctx, payload->text));
-                        JS_SetPropertyStr(ctx, edata_obj, "confidence", JS_NewFloat64(ctx, payload->confidence));
+                if(payload->type == IVS_CHUNK_TYPE_FILE) {
+                    JS_SetPropertyStr(ctx, edata_obj, "file", JS_NewStringLen(ctx, payload->data, payload->data_len));
+                } else if(payload->type == IVS_CHUNK_TYPE_BUFFER) {
+                    // the buffer goes to js as is, the payload doesn't own it anymore
+                    JSValue abuf = JS_NewArrayBuffer(ctx, payload->data, payload->data_len, js_ivs_chunk_buffer_free, NULL, false);
+                    if(!JS_IsException(abuf)) {
+                        payload->data = NULL;
+                        payload->data_len = 0;
                     }
-                    break;
+                    JS_SetPropertyStr(ctx, edata_obj, "buffer", abuf);
                 }
-                case IVS_EVENT_NLP_DONE: {
-                    ivs_event_payload_nlp_t *payload = (ivs_event_payload_nlp_t *)event->payload;
-                    edata_obj = JS_NewObject(ctx);
-                    JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "nlp-done"));
-                    JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
-
-                    if(payload) {
-                        JS_SetPropertyStr(ctx, edata_obj, "role", JS_NewString(ctx, payload->role));
-                        JS_SetPropertyStr(ctx, edata_obj, "text", JS_NewString(ctx, payload->text));
-                    }
-                    break;
-                }
-                case IVS_EVENT_CURL_DONE: {
-                    ivs_event_payload_curl_t *payload = (ivs_event_payload_curl_t *)event->payload;
-                    edata_obj = JS_NewObject(ctx);
-                    JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "curl-done"));
-                    JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
-
-                    if(payload) {
-                        JS_SetPropertyStr(ctx, edata_obj, "body", JS_NewStringLen(ctx, payload->body, payload->body_len));
-                        JS_SetPropertyStr(ctx, edata_obj, "code", JS_NewInt32(ctx, payload->http_code));
-                    }
-                    break;
-                }
-
-                default:
-                    JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "unknown"));
-                    break;
             }
+            break;
         }
-        ivs_event_free(event);
+        case IVS_EVENT_TRANSCRIPTION_DONE: {
+            ivs_event_payload_transcription_t *payload = (ivs_event_payload_transcription_t *)event->payload;
+            edata_obj = JS_NewObject(ctx);
+            JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "transcription-done"));
+            JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
+
+            if(payload) {
+                JS_SetPropertyStr(ctx, edata_obj, "text", JS_NewString(ctx, payload->text));
+                JS_SetPropertyStr(ctx, edata_obj, "confidence", JS_NewFloat64(ctx, payload->confidence));
+            }
+            break;
+        }
+        case IVS_EVENT_NLP_DONE: {
+            ivs_event_payload_nlp_t *payload = (ivs_event_payload_nlp_t *)event->payload;
+            edata_obj = JS_NewObject(ctx);
+            JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "nlp-done"));
+            JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
+
+            if(payload) {
+                JS_SetPropertyStr(ctx, edata_obj, "role", JS_NewString(ctx, payload->role));
+                JS_SetPropertyStr(ctx, edata_obj, "text", JS_NewString(ctx, payload->text));
+            }
+            break;
+        }
+        case IVS_EVENT_DTMF: {
+            ivs_event_payload_dtmf_t *payload = (ivs_event_payload_dtmf_t *)event->payload;
+            edata_obj = JS_NewObject(ctx);
+            JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "dtmf"));
+            JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
+
+            if(payload) {
+                JS_SetPropertyStr(ctx, edata_obj, "digit", JS_NewStringLen(ctx, &payload->digit, 1));
+                JS_SetPropertyStr(ctx, edata_obj, "duration", JS_NewInt32(ctx, payload->duration_ms));
+                JS_SetPropertyStr(ctx, edata_obj, "timestamp", JS_NewInt64(ctx, payload->timestamp));
+            }
+            break;
+        }
+        case IVS_EVENT_DTMF_COLLECTED: {
+            ivs_event_payload_dtmf_collected_t *payload = (ivs_event_payload_dtmf_collected_t *)event->payload;
+            edata_obj = JS_NewObject(ctx);
+            JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "dtmf-collected"));
+            JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
+
+            if(payload) {
+                JS_SetPropertyStr(ctx, edata_obj, "digits", JS_NewString(ctx, payload->digits));
+                JS_SetPropertyStr(ctx, edata_obj, "reason", JS_NewString(ctx, ivs_dtmfCollectReason2name(payload->reason)));
+            }
+            break;
+        }
+        case IVS_EVENT_CURL_DONE: {
+            ivs_event_payload_curl_t *payload = (ivs_event_payload_curl_t *)event->payload;
+            edata_obj = JS_NewObject(ctx);
+            JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "curl-done"));
+            JS_SetPropertyStr(ctx, ret_val, "data", edata_obj);
+
+            if(payload) {
+                JS_SetPropertyStr(ctx, edata_obj, "body", JS_NewStringLen(ctx, payload->body, payload->body_len));
+                JS_SetPropertyStr(ctx, edata_obj, "code", JS_NewInt32(ctx, payload->http_code));
+            }
+            break;
+        }
+
+        default:
+            JS_SetPropertyStr(ctx, ret_val, "type", JS_NewString(ctx, "unknown"));
+            break;
+    }
+
+    return ret_val;
+}
+
+static JSValue js_ivs_event_pop(JSContext *ctx, js_ivs_t *js_ivs, int32_t timeout_ms) {
+    ivs_session_t *ivs_session = js_ivs->session;
+    JSValue ret_val = JS_UNDEFINED;
+    void *pop = NULL;
+
+    if(ivs_session_event_wait(ivs_session, timeout_ms, &pop) == SWITCH_STATUS_SUCCESS) {
+        ivs_event_t *event = (ivs_event_t *)pop;
+        if(event) {
+            ret_val = js_ivs_event_to_object(ctx, event);
+        }
+        ivs_event_release(ivs_session->events, event);
     }
 
-    return (fl_found ? ret_val : JS_UNDEFINED);
+    return ret_val;
+}
+
+static JSValue js_ivs_get_event(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    js_ivs_t *js_ivs = JS_GetOpaque2(ctx, this_val, js_ivs_get_classid(ctx));
+
+    IVS_SESSION_SANITY_CHECK();
+
+    return js_ivs_event_pop(ctx, js_ivs, 0);
+}
+
+// waitEvent([timeoutMs]) - undefined on timeout or when the session is going down
+static JSValue js_ivs_wait_event(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    js_ivs_t *js_ivs = JS_GetOpaque2(ctx, this_val, js_ivs_get_classid(ctx));
+    int32_t timeout_ms = -1;
+
+    IVS_SESSION_SANITY_CHECK();
+
+    if(argc > 0 && !JS_IsUndefined(argv[0]) && !JS_IsNull(argv[0])) {
+        if(JS_ToInt32(ctx, &timeout_ms, argv[0])) {
+            return JS_EXCEPTION;
+        }
+    }
+
+    return js_ivs_event_pop(ctx, js_ivs, timeout_ms);
+}
+
+// getEvents([max], [timeoutMs]) - drains up to max events in one call, the timeout applies to the first one only
+static JSValue js_ivs_get_events(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    js_ivs_t *js_ivs = JS_GetOpaque2(ctx, this_val, js_ivs_get_classid(ctx));
+    ivs_session_t *ivs_session = NULL;
+    JSValue ret_val = JS_UNDEFINED;
+    uint32_t max = EVENTS_QUEUE_SIZE;
+    int32_t timeout_ms = 0;
+    uint32_t count = 0;
+    void *pop = NULL;
+
+    IVS_SESSION_SANITY_CHECK();
+
+    ivs_session = js_ivs->session;
+
+    if(argc > 0 && !JS_IsUndefined(argv[0]) && !JS_IsNull(argv[0])) {
+        int32_t tmax = 0;
+        if(JS_ToInt32(ctx, &tmax, argv[0])) {
+            return JS_EXCEPTION;
+        }
+        // <= 0: the whole queue, more than the queue can't be there anyway
+        max = ((tmax <= 0 || tmax > EVENTS_QUEUE_SIZE) ? EVENTS_QUEUE_SIZE : (uint32_t)tmax);
+    }
+    if(argc > 1 && !JS_IsUndefined(argv[1]) && !JS_IsNull(argv[1])) {
+        if(JS_ToInt32(ctx, &timeout_ms, argv[1])) {
+            return JS_EXCEPTION;
+        }
+    }
+
+    ret_val = JS_NewArray(ctx);
+    if(JS_IsException(ret_val)) {
+        return ret_val;
+    }
+
+    while(count < max) {
+        if(ivs_session_event_wait(ivs_session, (count ? 0 : timeout_ms), &pop) != SWITCH_STATUS_SUCCESS) {
+            break;
+        }
+        if(pop) {
+            ivs_event_t *event = (ivs_event_t *)pop;
+            JS_SetPropertyUint32(ctx, ret_val, count++, js_ivs_event_to_object(ctx, event));
+            ivs_event_release(ivs_session->events, event);
+        }
+        pop = NULL;
+    }
+
+    return ret_val;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -355,11 +826,29 @@ static const JSCFunctionListEntry js_ivs_proto_funcs[] = {
     JS_CGETSET_MAGIC_DEF("vadState", js_ivs_property_get, js_ivs_property_set, PROP_VAD_STATE),
     JS_CGETSET_MAGIC_DEF("chunkType", js_ivs_property_get, js_ivs_property_set, PROP_CHUNK_TYPE),
     JS_CGETSET_MAGIC_DEF("chunkEncoding", js_ivs_property_get, js_ivs_property_set, PROP_CHUNK_ENCODING),
+    JS_CGETSET_MAGIC_DEF("chunkMode", js_ivs_property_get, js_ivs_property_set, PROP_CHUNK_MODE),
+    JS_CGETSET_MAGIC_DEF("chunkSamplerate", js_ivs_property_get, js_ivs_property_set, PROP_CHUNK_SAMPLERATE),
+    JS_CGETSET_MAGIC_DEF("bargeIn", js_ivs_property_get, js_ivs_property_set, PROP_BARGE_IN),
+    JS_CGETSET_MAGIC_DEF("noiseSuppression", js_ivs_property_get, js_ivs_property_set, PROP_NOISE_SUPPRESSION),
+    JS_CGETSET_MAGIC_DEF("chunkCompact", js_ivs_property_get, js_ivs_property_set, PROP_CHUNK_COMPACT),
+    JS_CGETSET_MAGIC_DEF("chunkLength", js_ivs_property_get, js_ivs_property_set, PROP_CHUNK_LENGTH),
+    JS_CGETSET_MAGIC_DEF("vadSilenceMs", js_ivs_property_get, js_ivs_property_set, PROP_VAD_SILENCE_MS),
+    JS_CGETSET_MAGIC_DEF("vadVoiceMs", js_ivs_property_get, js_ivs_property_set, PROP_VAD_VOICE_MS),
+    JS_CGETSET_MAGIC_DEF("vadThreshold", js_ivs_property_get, js_ivs_property_set, PROP_VAD_THRESHOLD),
+    JS_CGETSET_MAGIC_DEF("vadAdaptive", js_ivs_property_get, js_ivs_property_set, PROP_VAD_ADAPTIVE),
+    JS_CGETSET_MAGIC_DEF("expectShortAnswer", js_ivs_property_get, js_ivs_property_set, PROP_EXPECT_SHORT_ANSWER),
     //
     JS_CFUNC_DEF("say", 1, js_ivs_say),
     JS_CFUNC_DEF("playback", 1, js_ivs_playback),
     JS_CFUNC_DEF("playbackStop", 0, js_ivs_playback_stop),
     JS_CFUNC_DEF("getEvent", 0, js_ivs_get_event),
+    JS_CFUNC_DEF("waitEvent", 1, js_ivs_wait_event),
+    JS_CFUNC_DEF("getEvents", 1, js_ivs_get_events),
+    JS_CFUNC_DEF("subscribe", 1, js_ivs_subscribe),
+    JS_CFUNC_DEF("unsubscribe", 1, js_ivs_unsubscribe),
+    JS_CFUNC_DEF("setAudioFilters", 1, js_ivs_set_audio_filters),
+    JS_CFUNC_DEF("collectDigits", 1, js_ivs_collect_digits),
+    JS_CFUNC_DEF("collectDigitsStop", 0, js_ivs_collect_digits_stop),
 };
 
 static void js_ivs_finalizer(JSRuntime *rt, JSValue val) {
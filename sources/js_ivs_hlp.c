@@ -3,6 +3,7 @@
  * https://github.com/akscf/
  **/
 #include "js_ivs_hlp.h"
+#include "ivs_events.h"
 
 const char *ivs_chunkType2name(uint32_t id) {
     switch(id) {
@@ -30,6 +31,8 @@ const char *ivs_chunkEncoding2name(uint32_t id) {
         case IVS_CHUNK_ENCODING_MP3: return "mp3";
         case IVS_CHUNK_ENCODING_RAW: return "raw";
         case IVS_CHUNK_ENCODING_B64: return "b64";
+        case IVS_CHUNK_ENCODING_OPUS: return "opus";
+        case IVS_CHUNK_ENCODING_FLAC: return "flac";
     }
     return "none";
 }
@@ -47,9 +50,41 @@ uint32_t ivs_chunkEncoding2id(const char *name) {
         if(strcasecmp(name, "b64") == 0) {
             return IVS_CHUNK_ENCODING_B64;
         }
+        if(strcasecmp(name, "opus") == 0) {
+            return IVS_CHUNK_ENCODING_OPUS;
+        }
+        if(strcasecmp(name, "flac") == 0) {
+            return IVS_CHUNK_ENCODING_FLAC;
+        }
     }
     return IVS_CHUNK_ENCODING_NONE;
 }
+// file extension (opus goes in ogg container)
+const char *ivs_chunkEncoding2ext(uint32_t id) {
+    if(id == IVS_CHUNK_ENCODING_OPUS) {
+        return "ogg";
+    }
+    return ivs_chunkEncoding2name(id);
+}
+
+const char *ivs_chunkMode2name(uint32_t id) {
+    switch(id) {
+        case IVS_CHUNK_MODE_UTTERANCE: return "utterance";
+        case IVS_CHUNK_MODE_STREAM:    return "stream";
+    }
+    return "utterance";
+}
+uint32_t ivs_chunkMode2id(const char *name) {
+    if(!zstr(name)) {
+        if(strcasecmp(name, "utterance") == 0) {
+            return IVS_CHUNK_MODE_UTTERANCE;
+        }
+        if(strcasecmp(name, "stream") == 0) {
+            return IVS_CHUNK_MODE_STREAM;
+        }
+    }
+    return IVS_CHUNK_MODE_UTTERANCE;
+}
 
 const char *ivs_vadState2name(switch_vad_state_t st) {
     switch(st) {
@@ -60,3 +95,41 @@ const char *ivs_vadState2name(switch_vad_state_t st) {
     }
     return "unknown";
 }
+
+const char *ivs_endpointReason2name(uint32_t reason) {
+    switch(reason) {
+        case IVS_EP_REASON_SHORT_ANSWER:    return "short-answer";
+        case IVS_EP_REASON_LONG:            return "long";
+        case IVS_EP_REASON_FALLING:         return "falling";
+        case IVS_EP_REASON_MID_SENTENCE:    return "mid-sentence";
+        case IVS_EP_REASON_MAX:             return "max";
+    }
+    return "unknown";
+}
+
+const char *ivs_dtmfCollectReason2name(uint32_t reason) {
+    switch(reason) {
+        case IVS_DTMF_COLLECT_MAX_DIGITS:   return "max-digits";
+        case IVS_DTMF_COLLECT_TERMINATOR:   return "terminator";
+        case IVS_DTMF_COLLECT_TIMEOUT:      return "timeout";
+        case IVS_DTMF_COLLECT_CANCELED:     return "canceled";
+    }
+    return "unknown";
+}
+
+uint32_t ivs_eventType2id(const char *name) {
+    if(!zstr(name)) {
+        if(strcasecmp(name, "speaking-start") == 0)     { return IVS_EVENT_SPEAKING_START; }
+        if(strcasecmp(name, "speaking-stop") == 0)      { return IVS_EVENT_SPEAKING_STOP; }
+        if(strcasecmp(name, "chunk-ready") == 0)        { return IVS_EVENT_CHUNK_READY; }
+        if(strcasecmp(name, "playback-started") == 0)   { return IVS_EVENT_PLAYBACK_STARTED; }
+        if(strcasecmp(name, "playback-finished") == 0)  { return IVS_EVENT_PLAYBACK_FINISHED; }
+        if(strcasecmp(name, "transcription-done") == 0) { return IVS_EVENT_TRANSCRIPTION_DONE; }
+        if(strcasecmp(name, "nlp-done") == 0)           { return IVS_EVENT_NLP_DONE; }
+        if(strcasecmp(name, "curl-done") == 0)          { return IVS_EVENT_CURL_DONE; }
+        if(strcasecmp(name, "barge-in") == 0)           { return IVS_EVENT_BARGE_IN; }
+        if(strcasecmp(name, "dtmf") == 0)               { return IVS_EVENT_DTMF; }
+        if(strcasecmp(name, "dtmf-collected") == 0)     { return IVS_EVENT_DTMF_COLLECTED; }
+    }
+    return IVS_EVENT_NOP;
+}
@@ -12,7 +12,14 @@ uint32_t ivs_chunkType2id(const char *name);
 
 const char *ivs_chunkEncoding2name(uint32_t id);
 uint32_t ivs_chunkEncoding2id(const char *name);
+const char *ivs_chunkEncoding2ext(uint32_t id);
+
+const char *ivs_chunkMode2name(uint32_t id);
+uint32_t ivs_chunkMode2id(const char *name);
 
 const char *ivs_vadState2name(switch_vad_state_t st);
+const char *ivs_endpointReason2name(uint32_t reason);
+const char *ivs_dtmfCollectReason2name(uint32_t reason);
+uint32_t ivs_eventType2id(const char *name);
 #endif
 
@@ -3,10 +3,12 @@
  * https://github.com/akscf/
  **/
 #include "js_ivs_wrp.h"
+#include "ivs_chunk_store.h"
 
 typedef struct {
     uint32_t                jid;
     uint8_t                 fl_delete_file;
+    uint8_t                 fl_chunk;   // chunk store file (reference held by the job)
     uint8_t                 mode; // 0 - playback, 1-say
     char                    *data;
     char                    *lang;
@@ -29,13 +31,17 @@ static void *SWITCH_THREAD_FUNC js_ivs_async_playback_thread(switch_thread_t *th
         ivs_event_push(IVS_EVENTSQ(params->ivs_session), params->jid, IVS_EVENT_PLAYBACK_FINISHED, params->data, strlen(params->data));
     }
 
-    // relese sem
-    ivs_session_release(params->ivs_session);
-
+    // the session must stay alive here (session_id)
     if(params->fl_delete_file) {
-        unlink(params->data);
+        ivs_chunk_store_unlink(params->ivs_session->session_id, params->data);
+    }
+    if(params->fl_chunk) {
+        ivs_chunk_store_done(params->ivs_session->session_id, params->data);
     }
 
+    // relese sem
+    ivs_session_release(params->ivs_session);
+
     if(pool_local) {
         switch_core_destroy_memory_pool(&pool_local);
     }
@@ -67,6 +73,7 @@ uint32_t js_ivs_async_playback(ivs_session_t *ivs_session, const char *path, uin
 
     if(ivs_session_take(params->ivs_session)) {
         jid = params->jid;
+        params->fl_chunk = ivs_chunk_store_take(ivs_session->session_id, params->data, NULL, NULL, NULL);
         launch_thread(pool_local, js_ivs_async_playback_thread, params);
     }
 out:
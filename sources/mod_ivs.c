@@ -7,6 +7,13 @@
 #include "ivs_events.h"
 #include "js_ivs_hlp.h"
 #include "ivs_qjs.h"
+#include "ivs_workers.h"
+#include "ivs_cng.h"
+#include "ivs_vad.h"
+#include "ivs_chunk_store.h"
+#include "ivs_filters.h"
+#include "ivs_endpoint.h"
+#include "ivs_dtmf.h"
 
 globals_t globals;
 
@@ -14,13 +21,14 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_ivs_load);
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_ivs_shutdown);
 SWITCH_MODULE_DEFINITION(mod_ivs, mod_ivs_load, mod_ivs_shutdown, NULL);
 
-static void *SWITCH_THREAD_FUNC audio_processing_thread(switch_thread_t *thread, void *obj);
 
 // ---------------------------------------------------------------------------------------------------------------------------------------------
 // CMD/APP API
 // ---------------------------------------------------------------------------------------------------------------------------------------------
 #define CMD_SYNTAX "\n"\
         "list       - show active sessions\n" \
+        "workers    - show chunk workers\n" \
+        "stats [sid] - show session audio stats\n" \
         "kill [sid] - terminate session\n" \
         "playback [sid] [filePaht] - playback a file\n"
 
@@ -52,8 +60,9 @@ SWITCH_STANDARD_API(ivs_cmd_api) {
                 ivs_session = (ivs_session_t *)hval;
 
                 if(ivs_session_take(ivs_session)) {
-                    stream->write_function(stream, "%s [script:%s / caller-nuber: %s / called-number=%s / start-ts=%d]\n",
-                        ivs_session->session_id, ivs_session->script->name, ivs_session->caller_number, ivs_session->called_number, ivs_session->start_ts
+                    stream->write_function(stream, "%s [script:%s / caller-nuber: %s / called-number=%s / start-ts=%d / au-overruns=%u:%u]\n",
+                        ivs_session->session_id, ivs_session->script->name, ivs_session->caller_number, ivs_session->called_number, ivs_session->start_ts,
+                        audio_ring_overruns(ivs_session->au_ring_in), audio_ring_overruns(ivs_session->au_ring_out)
                     );
                     ivs_session_release(ivs_session);
                 }
@@ -61,8 +70,32 @@ SWITCH_STANDARD_API(ivs_cmd_api) {
             switch_mutex_unlock(globals.mutex_sessions);
             goto out;
         }
+        if(strcasecmp(argv[0], "workers") == 0) {
+            ivs_workers_stats(stream);
+            goto out;
+        }
         goto usage;
     }
+    if(strcasecmp(argv[0], "stats") == 0) {
+        char *sid = (argc >= 2 ? argv[1] : NULL);
+        ivs_session_t *ivs_session = NULL;
+
+        if(!sid) { goto usage; }
+
+        ivs_session = ivs_session_lookup(sid, true);
+        if(ivs_session) {
+            ivs_vad_stats(ivs_session->vad, stream);
+            switch_mutex_lock(ivs_session->mutex);
+            ivs_filter_chain_stats(ivs_session->filters, stream);
+            switch_mutex_unlock(ivs_session->mutex);
+            ivs_events_queue_stats(ivs_session->events, stream);
+            stream->write_function(stream, "au-overruns: in=%u, out=%u\n", audio_ring_overruns(ivs_session->au_ring_in), audio_ring_overruns(ivs_session->au_ring_out));
+            ivs_session_release(ivs_session);
+        } else {
+            stream->write_function(stream, "-ERR: session not found\n");
+        }
+        goto out;
+    }
     if(strcasecmp(argv[0], "kill") == 0) {
         char *sid = (argc >= 2 ? argv[1] : NULL);
         ivs_session_t *ivs_session = NULL;
@@ -112,19 +145,30 @@ SWITCH_STANDARD_APP(ivs_dp_app) {
     char *mycmd = NULL, *argv[10] = { 0 }; int argc = 0;
     char *script_name = NULL, *script_path_local = NULL, *script_args = NULL;
     //
-    switch_vad_t *vad = NULL;
+    ivs_vad_t *vad = NULL;
+    ivs_filter_chain_t *filters = NULL;
+    ivs_endpoint_t *endpoint = NULL;
+    uint8_t fl_vad_adaptive = false;
     switch_vad_state_t vad_state = 0;
     switch_timer_t timer = { 0 };
     switch_frame_t write_frame = { 0 };
     switch_frame_t *read_frame = NULL;
     switch_codec_t *session_write_codec = switch_core_session_get_write_codec(session);
     switch_codec_t *session_read_codec = switch_core_session_get_read_codec(session);
-    switch_byte_t *audio_io_buffer = NULL, *audio_tmp_buffer = NULL, *vad_buffer = NULL;
-    int32_t vad_buffer_offs = 0, vad_stored_frames = 0;
-    uint32_t audio_io_buffer_data_len = 0, audio_tmp_buffer_data_len = 0;
-    uint32_t enc_samplerate = 0, enc_flags = 0, dec_samplerate = 0, dec_flags = 0;
+    switch_byte_t *audio_io_buffer = NULL;
+    audio_preroll_t *vad_preroll = NULL;
+    uint8_t fl_frame_in_preroll = false;
+    uint32_t audio_io_buffer_data_len = 0;
+    uint32_t dec_samplerate = 0, dec_flags = 0;
+    ivs_cng_set_t *cng_set = NULL;
+    uint32_t cng_frame = 0;
+    switch_codec_t *cng_codec = NULL;
+    const switch_codec_implementation_t *cng_impl = NULL;
+    const char *cng_fmtp = NULL;
+    switch_byte_t *cng_sln_buffer = NULL, *cng_enc_buffer = NULL;
     uint8_t fl_capture_on = false, fl_has_audio = false, fl_skip_cng = false;
-    void *pop = NULL;
+    switch_byte_t *au_data = NULL;
+    uint32_t au_data_len = 0;
 
     if(!zstr(data)) {
         mycmd = strdup(data);
@@ -165,14 +209,19 @@ SWITCH_STANDARD_APP(ivs_dp_app) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
         switch_goto_status(SWITCH_STATUS_GENERR, out);
     }
-    if(switch_mutex_init(&ivs_session->mutex_xflags, SWITCH_MUTEX_NESTED, switch_core_session_get_pool(session)) != SWITCH_STATUS_SUCCESS) {
+    if(switch_mutex_init(&ivs_session->mutex_xflags, SWITCH_MUTEX_DEFAULT, switch_core_session_get_pool(session)) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
         switch_goto_status(SWITCH_STATUS_GENERR, out);
     }
 
-    switch_queue_create(&ivs_session->au_q_out, AUDIO_QUEUE_SIZE, switch_core_session_get_pool(session));
-    switch_queue_create(&ivs_session->au_q_in, AUDIO_QUEUE_SIZE, switch_core_session_get_pool(session));
-    switch_queue_create(&ivs_session->events, EVENTS_QUEUE_SIZE, switch_core_session_get_pool(session));
+    if(switch_thread_cond_create(&ivs_session->cond_xflags, switch_core_session_get_pool(session)) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_thread_cond_create() fail\n");
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    }
+
+    if(ivs_events_queue_create(&ivs_session->events, EVENTS_QUEUE_SIZE, switch_core_session_get_pool(session)) != SWITCH_STATUS_SUCCESS) {
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    }
 
     switch_core_session_get_read_impl(session, &read_impl);
 
@@ -185,14 +234,43 @@ SWITCH_STANDARD_APP(ivs_dp_app) {
     ivs_session->samplerate = read_impl.actual_samples_per_second; // samples_per_second
     ivs_session->encoded_bytes_per_packet = read_impl.encoded_bytes_per_packet;
     ivs_session->decoded_bytes_per_packet = read_impl.decoded_bytes_per_packet;
-    ivs_session->chunk_buffer_size = ((globals.cfg_chunk_len_sec * read_impl.actual_samples_per_second) * sizeof(int16_t));
-    ivs_session->vad_buffer_size = (ivs_session->decoded_bytes_per_packet * VAD_STORE_FRAMES);
+    ivs_session->chunk_len_sec = globals.cfg_chunk_len_sec;
+    ivs_session->chunk_buffer_size = ((ivs_session->chunk_len_sec * read_impl.actual_samples_per_second) * ivs_session->channels * sizeof(int16_t));
+    ivs_session->vad_preroll_frames = (ivs_session->ptime ? (globals.cfg_vad_preroll_ms / ivs_session->ptime) : 0);
+
+    // playback frames (encoded) and captured frames (L16)
+    if(audio_ring_create(&ivs_session->au_ring_in, AUDIO_QUEUE_SIZE, MAX(ivs_session->encoded_bytes_per_packet, ivs_session->decoded_bytes_per_packet), false, switch_core_session_get_pool(session)) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    }
+    if(audio_ring_create(&ivs_session->au_ring_out, (AUDIO_QUEUE_SIZE + ivs_session->vad_preroll_frames), ivs_session->decoded_bytes_per_packet, true, switch_core_session_get_pool(session)) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    }
+    // grows when chunks are resampled to a higher rate
+    if(switch_buffer_create_dynamic(&ivs_session->chunk_buffer, AUDIO_BUFFER_SIZE, ivs_session->chunk_buffer_size, 0) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    }
+    ivs_workers_attach(ivs_session);
     //
     ivs_session->language = globals.default_language;
     ivs_session->tts_engine = globals.default_tts_engine;
     ivs_session->asr_engine = globals.default_asr_engine;
     ivs_session->chunk_type = IVS_CHUNK_TYPE_BUFFER;
     ivs_session->chunk_encoding = IVS_CHUNK_ENCODING_RAW;
+    ivs_session->chunk_mode = IVS_CHUNK_MODE_UTTERANCE;
+    ivs_session->chunk_samplerate = globals.cfg_chunk_samplerate;
+    ivs_session->fl_barge_in = globals.cfg_barge_in;
+    ivs_session->audio_filters = globals.cfg_audio_filters;
+    ivs_session->fl_filters_changed = true;
+    ivs_session->fl_chunk_compact = globals.cfg_chunk_compact;
+    ivs_session->vad_silence_ms = globals.cfg_vad_silence_ms;
+    ivs_session->vad_voice_ms = globals.cfg_vad_voice_ms;
+    ivs_session->vad_threshold = globals.cfg_vad_threshold;
+    ivs_session->fl_vad_adaptive = globals.cfg_vad_adaptive;
+    ivs_session->fl_vad_changed = true;
+    ivs_session->chunk_utterance = 1;
     //
     ivs_session->start_ts = switch_epoch_time_now(NULL);
 
@@ -214,45 +292,39 @@ SWITCH_STANDARD_APP(ivs_dp_app) {
     );
 
     // ---------------------------------------------------------------------------------
-    if((write_frame.data = switch_core_session_alloc(session, AUDIO_BUFFER_SIZE)) == NULL) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
-        switch_goto_status(SWITCH_STATUS_GENERR, out);
-    }
     if((audio_io_buffer = switch_core_session_alloc(session, AUDIO_BUFFER_SIZE)) == NULL) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
         switch_goto_status(SWITCH_STATUS_GENERR, out);
     }
-    if((audio_tmp_buffer = switch_core_session_alloc(session, AUDIO_BUFFER_SIZE)) == NULL) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
-        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    if(globals.cfg_cng_lvl > 0) {
+        // the non-cached cng path (no set for the write codec)
+        cng_sln_buffer = switch_core_session_alloc(session, AUDIO_BUFFER_SIZE);
+        cng_enc_buffer = switch_core_session_alloc(session, AUDIO_BUFFER_SIZE);
+        if(!cng_sln_buffer || !cng_enc_buffer) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+            switch_goto_status(SWITCH_STATUS_GENERR, out);
+        }
     }
-    if((vad_buffer = switch_core_session_alloc(session, ivs_session->vad_buffer_size)) == NULL) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
-        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    if(ivs_session->vad_preroll_frames > 0) {
+        if(audio_preroll_create(&vad_preroll, ivs_session->vad_preroll_frames, ivs_session->decoded_bytes_per_packet, switch_core_session_get_pool(session)) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
+            switch_goto_status(SWITCH_STATUS_GENERR, out);
+        }
     }
     if(switch_core_timer_init(&timer, "soft", ivs_session->ptime, ivs_session->samplerate, switch_core_session_get_pool(session)) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "timer fail\n");
         switch_goto_status(SWITCH_STATUS_FALSE, out);
     }
 
-    if((vad = switch_vad_init(ivs_session->samplerate, ivs_session->channels)) == NULL) {
+    if(ivs_vad_create(&vad, globals.cfg_vad_engine, ivs_session->samplerate, ivs_session->channels, switch_core_session_get_pool(session)) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "vad fail\n");
         switch_goto_status(SWITCH_STATUS_FALSE, out);
     }
-    switch_vad_set_mode(vad, -1);
-    switch_vad_set_param(vad, "debug", globals.cfg_vad_debug);
-    if(globals.cfg_vad_silence_ms > 0)  { switch_vad_set_param(vad, "silence_ms", globals.cfg_vad_silence_ms); }
-    if(globals.cfg_vad_voice_ms > 0)    { switch_vad_set_param(vad, "voice_ms", globals.cfg_vad_voice_ms); }
-    if(globals.cfg_vad_threshold > 0)   { switch_vad_set_param(vad, "thresh", globals.cfg_vad_threshold); }
+    ivs_vad_set_param(vad, "debug", globals.cfg_vad_debug);
+    ivs_session->vad = vad;
 
     ivs_session->fl_ready = true;
 
-    if(ivs_session_take(ivs_session)) {
-        launch_thread(switch_core_session_get_pool(session), audio_processing_thread, ivs_session);
-    } else {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "ivs_session_take() fail\n");
-        goto out;
-    }
     if(ivs_session_take(ivs_session)) {
         launch_thread(switch_core_session_get_pool(session), script_maintenance_thread, ivs_session);
     } else {
@@ -265,23 +337,85 @@ SWITCH_STANDARD_APP(ivs_dp_app) {
             break;
         }
 
+        // vad params (config or ivs.vad*), the live vad keeps its state
+        if(ivs_session->fl_vad_changed) {
+            uint32_t silence_ms = 0, voice_ms = 0, thresh = 0;
+            uint8_t fl_short_answer = false;
+
+            switch_mutex_lock(ivs_session->mutex);
+            silence_ms = ivs_session->vad_silence_ms;
+            voice_ms = ivs_session->vad_voice_ms;
+            thresh = ivs_session->vad_threshold;
+            fl_vad_adaptive = ivs_session->fl_vad_adaptive;
+            fl_short_answer = ivs_session->fl_short_answer;
+            ivs_session->fl_vad_changed = false;
+            switch_mutex_unlock(ivs_session->mutex);
+
+            if(fl_vad_adaptive && !endpoint) {
+                if(ivs_endpoint_create(&endpoint, ivs_session->samplerate, ivs_session->channels, switch_core_session_get_pool(session)) != SWITCH_STATUS_SUCCESS) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Adaptive endpointing disabled\n");
+                    fl_vad_adaptive = false;
+                }
+            }
+            if(fl_vad_adaptive) {
+                // the vad hangover becomes the upper bound, the pauses are cut by the endpointer
+                ivs_endpoint_set_params(endpoint, silence_ms, thresh, fl_short_answer);
+                ivs_vad_set_param(vad, "silence_ms", ivs_endpoint_max_ms(endpoint));
+            } else if(silence_ms > 0) {
+                ivs_vad_set_param(vad, "silence_ms", silence_ms);
+            } else if(endpoint) {
+                ivs_vad_set_param(vad, "silence_ms", IVS_EP_BASE_MS);
+            }
+            if(voice_ms > 0)    { ivs_vad_set_param(vad, "voice_ms", voice_ms); }
+            if(thresh > 0)      { ivs_vad_set_param(vad, "thresh", thresh); }
+        }
+
+        // update the filters chain (unchanged stages are kept as is)
+        if(ivs_session->fl_filters_changed) {
+            char *spec = NULL;
+
+            switch_mutex_lock(ivs_session->mutex);
+            spec = (ivs_session->audio_filters ? strdup(ivs_session->audio_filters) : NULL);
+            ivs_session->fl_filters_changed = false;
+            switch_mutex_unlock(ivs_session->mutex);
+
+            if(ivs_filter_chain_update(&filters, ivs_session, spec) != SWITCH_STATUS_SUCCESS) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unable to update filters chain (%s)\n", spec);
+            }
+
+            switch_mutex_lock(ivs_session->mutex);
+            ivs_session->filters = filters;
+            switch_mutex_unlock(ivs_session->mutex);
+
+            switch_safe_free(spec);
+        }
+
+        // dtmf, during playback they belong to the input callback (prompt break)
+        if(!ivs_session_xflags_test(ivs_session, IVS_SF_PLAYBACK) && switch_channel_has_dtmf(channel)) {
+            switch_dtmf_t dtmf = { 0 };
+            while(switch_channel_dequeue_dtmf(channel, &dtmf) == SWITCH_STATUS_SUCCESS) {
+                ivs_dtmf_process(ivs_session, &dtmf);
+            }
+        }
+        ivs_dtmf_collect_timer(ivs_session);
+
         fl_skip_cng = false;
         fl_has_audio = false;
+        fl_frame_in_preroll = false;
 
-        if(switch_queue_trypop(ivs_session->au_q_in, &pop) == SWITCH_STATUS_SUCCESS) {
-            xdata_buffer_t *au_buffer = (xdata_buffer_t *)pop;
-            if(au_buffer && au_buffer->len > 0) {
+        if(audio_ring_peek(ivs_session->au_ring_in, &au_data, &au_data_len, NULL) == SWITCH_STATUS_SUCCESS) {
+            if(au_data_len > 0) {
                 dec_flags = 0;
                 dec_samplerate = ivs_session->samplerate;
                 audio_io_buffer_data_len = AUDIO_BUFFER_SIZE;
 
-                status = switch_core_codec_decode(session_read_codec, NULL, au_buffer->data, au_buffer->len, au_buffer->samplerate, audio_io_buffer, &audio_io_buffer_data_len, &dec_samplerate, &dec_flags);
+                status = switch_core_codec_decode(session_read_codec, NULL, au_data, au_data_len, ivs_session->samplerate, audio_io_buffer, &audio_io_buffer_data_len, &dec_samplerate, &dec_flags);
                 if(status == SWITCH_STATUS_SUCCESS && audio_io_buffer_data_len > 0) {
                     fl_has_audio = true;
                     fl_skip_cng = true;
                 }
             }
-            xdata_buffer_free(au_buffer);
+            audio_ring_release(ivs_session->au_ring_in);
         }
 
         if(fl_has_audio) {
@@ -308,20 +442,41 @@ SWITCH_STANDARD_APP(ivs_dp_app) {
 
         audio_produce:
         if(fl_has_audio) {
+            // echo gate, denoise, ... (in place)
+            if(filters) {
+                ivs_filter_chain_process(filters, (int16_t *)audio_io_buffer, (audio_io_buffer_data_len / sizeof(int16_t)));
+            }
+
             if(ivs_session->vad_state == SWITCH_VAD_STATE_STOP_TALKING || (ivs_session->vad_state == vad_state && vad_state == SWITCH_VAD_STATE_NONE)) {
-                if(audio_io_buffer_data_len <= ivs_session->decoded_bytes_per_packet) {
-                    if(vad_buffer_offs >= ivs_session->vad_buffer_size ) { vad_buffer_offs = 0; vad_stored_frames = 0;}
-                    memcpy((void *)(vad_buffer + vad_buffer_offs), audio_io_buffer, MIN(audio_io_buffer_data_len, ivs_session->decoded_bytes_per_packet));
-                    vad_buffer_offs += ivs_session->decoded_bytes_per_packet;
-                    vad_stored_frames++;
+                if(vad_preroll) {
+                    fl_frame_in_preroll = (audio_preroll_write(vad_preroll, audio_io_buffer, audio_io_buffer_data_len) == SWITCH_STATUS_SUCCESS);
                 }
             }
 
-            vad_state = switch_vad_process(vad, (int16_t *)audio_io_buffer, audio_io_buffer_data_len / sizeof(int16_t));
+            vad_state = ivs_vad_process(vad, (int16_t *)audio_io_buffer, audio_io_buffer_data_len / sizeof(int16_t));
+            if(fl_vad_adaptive) {
+                ivs_endpoint_decision_t decision = { 0 };
+
+                vad_state = ivs_endpoint_process(endpoint, vad_state, (int16_t *)audio_io_buffer, audio_io_buffer_data_len / sizeof(int16_t), &decision);
+                if(decision.timeout_ms) {
+                    if(globals.cfg_vad_debug) {
+                        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Endpoint: timeout=%ums, speech=%ums, silence=%ums, reasons=0x%x\n", decision.timeout_ms, decision.speech_ms, decision.silence_ms, decision.reasons);
+                    }
+                    switch_mutex_lock(ivs_session->mutex);
+                    ivs_session->ep_decision = decision;
+                    switch_mutex_unlock(ivs_session->mutex);
+                }
+            }
             if(vad_state == SWITCH_VAD_STATE_START_TALKING) {
                 if(vad_state != ivs_session->vad_state) {
                     ivs_event_push_simple(IVS_EVENTSQ(ivs_session), IVS_EVENT_SPEAKING_START, NULL);
                 }
+                // cut the prompt right here, the playback thread breaks on the next frame
+                if(ivs_session->fl_barge_in && ivs_session_xflags_test(ivs_session, IVS_SF_PLAYBACK) && !ivs_session_xflags_test(ivs_session, IVS_SF_BARGE_IN)) {
+                    ivs_session_xflags_set(ivs_session, IVS_SF_BARGE_IN, true);
+                    switch_channel_set_flag(channel, CF_BREAK);
+                    ivs_event_push_simple(IVS_EVENTSQ(ivs_session), IVS_EVENT_BARGE_IN, NULL);
+                }
                 ivs_session->vad_state = vad_state;
                 fl_capture_on = true;
             } else if (vad_state == SWITCH_VAD_STATE_STOP_TALKING) {
@@ -330,7 +485,10 @@ SWITCH_STANDARD_APP(ivs_dp_app) {
                 }
                 ivs_session->vad_state = vad_state;
                 fl_capture_on = false;
-                switch_vad_reset(vad);
+                ivs_vad_reset(vad);
+
+                audio_ring_write_marker(ivs_session->au_ring_out, AUDIO_RING_FLAG_EOU);
+                ivs_workers_schedule(ivs_session);
             } else if (vad_state == SWITCH_VAD_STATE_TALKING) {
                 if(vad_state != ivs_session->vad_state) {
                     /* nothing */
@@ -340,37 +498,24 @@ SWITCH_STANDARD_APP(ivs_dp_app) {
             }
 
             if(fl_capture_on) {
-                if(vad_state == SWITCH_VAD_STATE_START_TALKING && vad_buffer_offs > 0) {
-                    xdata_buffer_t *tau_buf = NULL;
-                    uint32_t tdata_len = 0;
-
-                    if(vad_stored_frames >= VAD_RECOVERY_FRAMES) { vad_stored_frames = VAD_RECOVERY_FRAMES; }
-
-                    vad_buffer_offs -= (vad_stored_frames * ivs_session->decoded_bytes_per_packet);
-                    if(vad_buffer_offs < 0 ) { vad_buffer_offs = 0; }
-
-                    tdata_len = (vad_stored_frames * ivs_session->decoded_bytes_per_packet) + audio_io_buffer_data_len;
-
-                    // fill-in xdata buffer
-                    switch_zmalloc(tau_buf, sizeof(xdata_buffer_t));
-                    switch_malloc(tau_buf->data, tdata_len);
-
-                    tau_buf->len = tdata_len;
-                    tau_buf->samplerate = ivs_session->samplerate;
-                    tau_buf->channels = ivs_session->channels;
-
-                    tdata_len = (vad_stored_frames * ivs_session->decoded_bytes_per_packet);
-                    memcpy(tau_buf->data, vad_buffer + vad_buffer_offs, tdata_len);
-                    memcpy(tau_buf->data + tdata_len, audio_io_buffer, audio_io_buffer_data_len);
-
-                    if(switch_queue_trypush(ivs_session->au_q_out, tau_buf) != SWITCH_STATUS_SUCCESS) {
-                        xdata_buffer_free(tau_buf);
+                if(vad_state == SWITCH_VAD_STATE_START_TALKING && vad_preroll && vad_preroll->count > 0) {
+                    switch_byte_t *span1 = NULL, *span2 = NULL;
+                    uint32_t span1_len = 0, span2_len = 0;
+
+                    // pre-roll already ends with the current frame (unless it didn't fit)
+                    audio_preroll_spans(vad_preroll, &span1, &span1_len, &span2, &span2_len);
+                    audio_ring_write_frames(ivs_session->au_ring_out, span1, span1_len, vad_preroll->frame_size);
+                    audio_ring_write_frames(ivs_session->au_ring_out, span2, span2_len, vad_preroll->frame_size);
+                    if(!fl_frame_in_preroll) {
+                        audio_ring_write(ivs_session->au_ring_out, audio_io_buffer, audio_io_buffer_data_len);
                     }
 
-                    vad_stored_frames = 0;
-                    vad_buffer_offs = 0;
+                    audio_preroll_reset(vad_preroll);
                 } else {
-                    xdata_buffer_push(ivs_session->au_q_out, audio_io_buffer, audio_io_buffer_data_len, ivs_session->samplerate, ivs_session->channels);
+                    audio_ring_write(ivs_session->au_ring_out, audio_io_buffer, audio_io_buffer_data_len);
+                }
+                if(audio_ring_count(ivs_session->au_ring_out) >= AUDIO_SCHED_FRAMES) {
+                    ivs_workers_schedule(ivs_session);
                 }
 
                 fl_capture_on = false;
@@ -378,24 +523,39 @@ SWITCH_STANDARD_APP(ivs_dp_app) {
         }
 
         if(!fl_skip_cng && globals.cfg_cng_lvl > 0) {
-            audio_tmp_buffer_data_len = (ivs_session->encoded_bytes_per_packet * sizeof(int16_t));
-            switch_generate_sln_silence((int16_t *) audio_tmp_buffer, ivs_session->encoded_bytes_per_packet, ivs_session->channels, globals.cfg_cng_lvl);
-            if(switch_core_codec_ready(session_write_codec)) {
-                enc_flags = 0;
-                enc_samplerate = ivs_session->samplerate;
-                audio_io_buffer_data_len = AUDIO_BUFFER_SIZE;
+            session_write_codec = switch_core_session_get_write_codec(session);
 
-                status = switch_core_codec_encode(session_write_codec, NULL, audio_tmp_buffer, audio_tmp_buffer_data_len, ivs_session->samplerate, audio_io_buffer, &audio_io_buffer_data_len, &enc_samplerate, &enc_flags);
-                if(status == SWITCH_STATUS_SUCCESS && audio_io_buffer_data_len > 0)  {
-                    write_frame.codec = session_write_codec;
-                    write_frame.buflen = AUDIO_BUFFER_SIZE;
-                    write_frame.datalen = audio_io_buffer_data_len;
-                    write_frame.samples = audio_io_buffer_data_len;
+            // the write codec can change in the middle of the call (re-invite)
+            if(session_write_codec != cng_codec || (session_write_codec && (session_write_codec->implementation != cng_impl || session_write_codec->fmtp_in != cng_fmtp))) {
+                cng_codec = session_write_codec;
+                cng_impl = (cng_codec ? cng_codec->implementation : NULL);
+                cng_fmtp = (cng_codec ? cng_codec->fmtp_in : NULL);
+                cng_frame = 0;
 
-                    memcpy(write_frame.data, audio_io_buffer, audio_io_buffer_data_len);
-                    switch_core_session_write_frame(session, &write_frame, SWITCH_IO_FLAG_NONE, 0);
+                if((cng_set = ivs_cng_lookup(cng_codec, globals.cfg_cng_lvl)) == NULL) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "No CNG set for the write codec, frames will be encoded on the fly\n");
                 }
             }
+
+            if(cng_set) {
+                // pre-encoded frames, written as is
+                write_frame.codec = session_write_codec;
+                write_frame.data = cng_set->frame_data[cng_frame];
+                write_frame.buflen = cng_set->frame_len[cng_frame];
+                write_frame.datalen = cng_set->frame_len[cng_frame];
+                write_frame.samples = cng_set->samples;
+
+                switch_core_session_write_frame(session, &write_frame, SWITCH_IO_FLAG_NONE, 0);
+
+                if(++cng_frame >= cng_set->frames) { cng_frame = 0; }
+            } else if((write_frame.datalen = ivs_cng_encode(session_write_codec, globals.cfg_cng_lvl, (int16_t *)cng_sln_buffer, cng_enc_buffer)) > 0) {
+                write_frame.codec = session_write_codec;
+                write_frame.data = cng_enc_buffer;
+                write_frame.buflen = AUDIO_BUFFER_SIZE;
+                write_frame.samples = session_write_codec->implementation->samples_per_packet;
+
+                switch_core_session_write_frame(session, &write_frame, SWITCH_IO_FLAG_NONE, 0);
+            }
         }
 
         timer_next:
@@ -411,13 +571,24 @@ out:
         switch_core_timer_destroy(&timer);
     }
     if(vad) {
-        switch_vad_destroy(&vad);
+        ivs_vad_destroy(&vad);
+    }
+    if(filters) {
+        switch_mutex_lock(ivs_session->mutex);
+        ivs_session->filters = NULL;
+        switch_mutex_unlock(ivs_session->mutex);
+        ivs_filter_chain_destroy(&filters);
     }
 
     if(ivs_session) {
         ivs_session->fl_ready = false;
         ivs_session->fl_destroyed = true;
 
+        // wake up the script (ivs.waitEvent)
+        if(ivs_session->events) {
+            switch_queue_interrupt_all(ivs_session->events->queue);
+        }
+
         if(ivs_session->wlocki > 0) {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Waiting for unlock (sid=%s, wlock=%i)\n", ivs_session->session_id, ivs_session->wlocki);
             while(ivs_session->wlocki > 0) {
@@ -425,23 +596,27 @@ out:
             }
         }
 
-        if(ivs_session->au_q_in) {
-            xdata_buffer_queue_clean(ivs_session->au_q_in);
-            switch_queue_term(ivs_session->au_q_in);
+        if(audio_ring_overruns(ivs_session->au_ring_in) || audio_ring_overruns(ivs_session->au_ring_out)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Audio ring overruns (sid=%s, in=%u, out=%u)\n",
+                ivs_session->session_id, audio_ring_overruns(ivs_session->au_ring_in), audio_ring_overruns(ivs_session->au_ring_out)
+            );
         }
 
-        if(ivs_session->au_q_out) {
-            xdata_buffer_queue_clean(ivs_session->au_q_out);
-            switch_queue_term(ivs_session->au_q_out);
+        if(ivs_session->chunk_resampler) {
+            switch_resample_destroy(&ivs_session->chunk_resampler);
+        }
+        if(ivs_session->chunk_buffer) {
+            switch_buffer_destroy(&ivs_session->chunk_buffer);
         }
 
         if(ivs_session->events) {
-            ivs_events_queue_clean(ivs_session->events);
-            switch_queue_term(ivs_session->events);
+            ivs_events_queue_destroy(ivs_session->events);
         }
 
         js_script_destroy(ivs_session);
 
+        ivs_chunk_store_session_cleanup(ivs_session->session_id);
+
         switch_mutex_lock(globals.mutex_sessions);
         switch_core_hash_delete(globals.sessions, ivs_session->session_id);
         switch_mutex_unlock(globals.mutex_sessions);
@@ -451,109 +626,6 @@ out:
     switch_safe_free(mycmd);
 }
 
-// ---------------------------------------------------------------------------------------------------------------------------------------------
-static void *SWITCH_THREAD_FUNC audio_processing_thread(switch_thread_t *thread, void *obj) {
-    volatile ivs_session_t *_ref = (ivs_session_t *) obj;
-    ivs_session_t *ivs_session = (ivs_session_t *) _ref;
-    switch_core_session_t *session = ivs_session->session;
-    switch_memory_pool_t *pool = NULL;
-    switch_buffer_t *chunk_buffer = NULL;
-    uint32_t chunk_type_local = 0, chunk_encoding_local = 0;
-
-    uint8_t fl_chunk_ready = false;
-    void *pop = NULL;
-
-    if(switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "pool fail\n");
-        goto out;
-    }
-    if(switch_buffer_create(pool, &chunk_buffer, ivs_session->chunk_buffer_size) != SWITCH_STATUS_SUCCESS) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "mem fail\n");
-        goto out;
-    }
-
-    switch_buffer_zero(chunk_buffer);
-
-    while(true) {
-        if(globals.fl_shutdown || ivs_session->fl_do_destroy || ivs_session->fl_destroyed ) {
-            break;
-        }
-        if(!ivs_session->fl_ready) {
-            goto timer_next;
-        }
-
-        if(switch_queue_trypop(ivs_session->au_q_out, &pop) == SWITCH_STATUS_SUCCESS) {
-            xdata_buffer_t *au_data = (xdata_buffer_t *)pop;
-            if(au_data->len > 0) {
-                uint32_t sz = switch_buffer_write(chunk_buffer, au_data->data, au_data->len);
-                if(sz >= ivs_session->chunk_buffer_size) { fl_chunk_ready = true; }
-            }
-            xdata_buffer_free(au_data);
-        }
-
-        if(!fl_chunk_ready) {
-            fl_chunk_ready = (switch_buffer_inuse(chunk_buffer) > 0 && ivs_session->vad_state == SWITCH_VAD_STATE_STOP_TALKING);
-        }
-        if(fl_chunk_ready) {
-            const void *ptr = NULL;
-            uint32_t buf_len = switch_buffer_peek_zerocopy(chunk_buffer, &ptr);
-            uint32_t buf_time = (buf_len / ivs_session->samplerate);
-
-            switch_mutex_lock(ivs_session->mutex);
-            chunk_type_local = ivs_session->chunk_type;
-            chunk_encoding_local = ivs_session->chunk_encoding;
-            switch_mutex_unlock(ivs_session->mutex);
-
-            if(chunk_type_local == IVS_CHUNK_TYPE_FILE) {
-                char *ofname = audio_file_write((switch_byte_t *)ptr, buf_len, ivs_session->samplerate, ivs_session->channels, ivs_chunkEncoding2name(chunk_encoding_local));
-                if(ofname == NULL) {
-                    switch_buffer_zero(chunk_buffer);
-                    fl_chunk_ready = false;
-                    goto timer_next;
-                }
-                ivs_event_push_chunk_ready(IVS_EVENTSQ(ivs_session), ivs_session->samplerate, ivs_session->channels, buf_time, buf_len, ofname, strlen(ofname));
-                switch_safe_free(ofname);
-            } else if(chunk_type_local == IVS_CHUNK_TYPE_BUFFER) {
-                if(chunk_encoding_local == IVS_CHUNK_ENCODING_RAW) {
-                    ivs_event_push_chunk_ready(IVS_EVENTSQ(ivs_session), ivs_session->samplerate, ivs_session->channels, buf_time, buf_len, (switch_byte_t *)ptr, buf_len);
-                } else if(chunk_encoding_local == IVS_CHUNK_ENCODING_B64) {
-                    switch_byte_t *b64_buffer = NULL;
-                    uint32_t b64_buffer_len = BASE64_ENC_SZ(buf_len);
-
-                    switch_malloc(b64_buffer, b64_buffer_len);
-                    if(switch_b64_encode((uint8_t *)ptr, buf_len, b64_buffer, b64_buffer_len) == SWITCH_STATUS_SUCCESS) {
-                        ivs_event_push_chunk_ready_zerocopy(IVS_EVENTSQ(ivs_session), ivs_session->samplerate, ivs_session->channels, buf_time, buf_len, b64_buffer, b64_buffer_len);
-                    } else {
-                        switch_safe_free(b64_buffer);
-                        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_b64_encode() fail\n");
-                    }
-                } else {
-                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unsupported encoding type: %s\n", ivs_chunkEncoding2name(chunk_encoding_local));
-                }
-            }
-
-            switch_buffer_zero(chunk_buffer);
-            fl_chunk_ready = false;
-        }
-
-        timer_next:
-        switch_yield(10000);
-    }
-out:
-    if(chunk_buffer) {
-        switch_buffer_destroy(&chunk_buffer);
-    }
-    if(pool) {
-        switch_core_destroy_memory_pool(&pool);
-    }
-
-    ivs_session_release(ivs_session);
-
-    thread_finished();
-
-    return NULL;
-}
-
 // ---------------------------------------------------------------------------------------------------------------------------------------------
 // main
 // ---------------------------------------------------------------------------------------------------------------------------------------------
@@ -583,12 +655,50 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_ivs_load) {
                 if(val) globals.cfg_cng_lvl = atoi (val);
             } else if(!strcasecmp(var, "chunk-len-sec")) {
                 if(val) globals.cfg_chunk_len_sec = atoi (val);
+            } else if(!strcasecmp(var, "chunk-samplerate")) {
+                if(val) globals.cfg_chunk_samplerate = atoi (val);
+            } else if(!strcasecmp(var, "chunk-stream-ms")) {
+                if(val) globals.cfg_chunk_stream_ms = atoi (val);
+            } else if(!strcasecmp(var, "chunk-overlap-ms")) {
+                if(val) globals.cfg_chunk_overlap_ms = atoi (val);
+            } else if(!strcasecmp(var, "chunk-compact")) {
+                if(val) globals.cfg_chunk_compact = switch_true(val);
+            } else if(!strcasecmp(var, "chunk-compact-pause-ms")) {
+                if(val) globals.cfg_chunk_compact_pause_ms = atoi (val);
+            } else if(!strcasecmp(var, "chunk-opus-bitrate")) {
+                if(val) globals.cfg_opus_bitrate = atoi (val);
+            } else if(!strcasecmp(var, "chunk-opus-complexity")) {
+                if(val) globals.cfg_opus_complexity = atoi (val);
+            } else if(!strcasecmp(var, "chunk-flac-level")) {
+                if(val) globals.cfg_flac_level = atoi (val);
+            } else if(!strcasecmp(var, "chunk-store")) {
+                if(val) globals.cfg_chunk_store = switch_core_strdup(pool, val);
+            } else if(!strcasecmp(var, "chunk-workers")) {
+                if(val) globals.cfg_chunk_workers = atoi (val);
             } else if(!strcasecmp(var, "vad-voice-ms")) {
                 if(val) globals.cfg_vad_voice_ms = atoi (val);
             } else if(!strcasecmp(var, "vad-silence-ms")) {
                 if(val) globals.cfg_vad_silence_ms = atoi (val);
             } else if(!strcasecmp(var, "vad-threshold")) {
                 if(val) globals.cfg_vad_threshold = atoi (val);
+            } else if(!strcasecmp(var, "vad-engine")) {
+                if(val) globals.cfg_vad_engine = ivs_vad_engine2id(val);
+            } else if(!strcasecmp(var, "vad-preroll-ms")) {
+                if(val) globals.cfg_vad_preroll_ms = atoi (val);
+            } else if(!strcasecmp(var, "echo-gate")) {
+                if(val) globals.cfg_echo_gate = switch_true(val);
+            } else if(!strcasecmp(var, "echo-erl-db")) {
+                if(val) globals.cfg_echo_erl_db = atoi (val);
+            } else if(!strcasecmp(var, "echo-tail-ms")) {
+                if(val) globals.cfg_echo_tail_ms = atoi (val);
+            } else if(!strcasecmp(var, "barge-in")) {
+                if(val) globals.cfg_barge_in = switch_true(val);
+            } else if(!strcasecmp(var, "audio-filters")) {
+                if(val) globals.cfg_audio_filters = switch_core_strdup(pool, val);
+            } else if(!strcasecmp(var, "noise-suppression")) {
+                if(val) globals.cfg_noise_suppression = switch_true(val);
+            } else if(!strcasecmp(var, "vad-adaptive")) {
+                if(val) globals.cfg_vad_adaptive = switch_true(val);
             } else if(!strcasecmp(var, "vad-debug")) {
                 if(val) globals.cfg_vad_debug = switch_true(val);
             } else if(!strcasecmp(var, "default-asr-engine")) {
@@ -602,6 +712,35 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_ivs_load) {
     }
 
     globals.cfg_chunk_len_sec = (globals.cfg_chunk_len_sec ? globals.cfg_chunk_len_sec : 15);
+    globals.cfg_vad_preroll_ms = (globals.cfg_vad_preroll_ms ? globals.cfg_vad_preroll_ms : VAD_PREROLL_MS);
+    globals.cfg_echo_erl_db = (globals.cfg_echo_erl_db ? globals.cfg_echo_erl_db : 6);
+    globals.cfg_echo_tail_ms = (globals.cfg_echo_tail_ms ? globals.cfg_echo_tail_ms : 200);
+    if(globals.cfg_chunk_samplerate && !IVS_CHUNK_SAMPLERATE_VALID(globals.cfg_chunk_samplerate)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "chunk-samplerate: unsupported value (%u), the codec rate will be used\n", globals.cfg_chunk_samplerate);
+        globals.cfg_chunk_samplerate = 0;
+    }
+    globals.cfg_chunk_stream_ms = (globals.cfg_chunk_stream_ms ? globals.cfg_chunk_stream_ms : 1000);
+    globals.cfg_chunk_compact_pause_ms = (globals.cfg_chunk_compact_pause_ms ? globals.cfg_chunk_compact_pause_ms : 300);
+    globals.cfg_opus_bitrate = (globals.cfg_opus_bitrate ? globals.cfg_opus_bitrate : 16000);
+    globals.cfg_opus_complexity = (globals.cfg_opus_complexity ? MIN(globals.cfg_opus_complexity, 10) : 5);
+    globals.cfg_flac_level = (globals.cfg_flac_level ? MIN(globals.cfg_flac_level, 8) : 5);
+
+    // echo-gate / noise-suppression are shortcuts for the filters chain
+    if(globals.cfg_echo_gate && !ivs_filter_spec_has(globals.cfg_audio_filters, "echo-gate")) {
+        globals.cfg_audio_filters = (zstr(globals.cfg_audio_filters) ? "echo-gate" : switch_core_sprintf(pool, "echo-gate,%s", globals.cfg_audio_filters));
+    }
+    if(globals.cfg_noise_suppression) {
+        globals.cfg_audio_filters = ivs_filter_spec_toggle(globals.cfg_audio_filters, "denoise", true, pool);
+    }
+
+    ivs_cng_init(pool);
+    ivs_audio_filters_init(pool);
+    ivs_chunk_store_init(pool, globals.cfg_chunk_store);
+
+    if(ivs_workers_start(pool, globals.cfg_chunk_workers) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to start chunk workers\n");
+        switch_goto_status(SWITCH_STATUS_GENERR, done);
+    }
 
     // --------------------------------
     *module_interface = switch_loadable_module_create_module_interface(pool, modname);
@@ -647,6 +786,10 @@ SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_ivs_shutdown) {
     switch_core_hash_destroy(&globals.sessions);
     switch_mutex_unlock(globals.mutex_sessions);
 
+    ivs_cng_shutdown();
+    ivs_audio_filters_shutdown();
+    ivs_chunk_store_shutdown();
+
     return SWITCH_STATUS_SUCCESS;
 }
 
@@ -32,21 +32,40 @@
 #define IVS_VERSION                     "1.0 (a52)"
 #define AUDIO_BUFFER_SIZE               (8*1024) // SWITCH_RECOMMENDED_BUFFER_SIZE
 #define AUDIO_QUEUE_SIZE                64
+#define AUDIO_SCHED_FRAMES              (AUDIO_QUEUE_SIZE / 4) // hand captured audio over to a chunk worker every N frames
 #define EVENTS_QUEUE_SIZE               128
-#define VAD_STORE_FRAMES                64
-#define VAD_RECOVERY_FRAMES             15
+#define VAD_PREROLL_MS                  300
+#define AUDIO_RING_FLAG_EOU             0x1     // end of utterance (zero length slot)
 
 #define IVS_CHUNK_TYPE_BUFFER           0
 #define IVS_CHUNK_TYPE_FILE             1
 #define IVS_CHUNK_ENCODING_NONE         0 // not defined
-#define IVS_CHUNK_ENCODING_WAV          1 // FILE_WAV
-#define IVS_CHUNK_ENCODING_MP3          2 // FILE_MP3
+#define IVS_CHUNK_ENCODING_WAV          1 // FILE_WAV / BUFFER_WAV
+#define IVS_CHUNK_ENCODING_MP3          2 // FILE_MP3 / BUFFER_MP3 (IVS_WITH_MP3LAME)
 #define IVS_CHUNK_ENCODING_RAW          3 // BUFFER_L16
 #define IVS_CHUNK_ENCODING_B64          4 // BUFFER_BASE64
+#define IVS_CHUNK_ENCODING_OPUS         5 // FILE_OGG / BUFFER_OGG (IVS_WITH_OPUS)
+#define IVS_CHUNK_ENCODING_FLAC         6 // FILE_FLAC / BUFFER_FLAC (IVS_WITH_FLAC)
+#define IVS_CHUNK_MODE_UTTERANCE        0 // one chunk per utterance (or chunk-len-sec)
+#define IVS_CHUNK_MODE_STREAM           1 // overlapping partials while talking + final one
+#define IVS_CHUNK_SAMPLERATE_VALID(r)   ((r) >= 8000 && (r) <= 48000)
 
 #define JID_NONE                        0x0
 
 #define IVS_SF_PLAYBACK                 0x0
+#define IVS_SF_BARGE_IN                 0x1     // current playback interrupted by the caller
+
+#define IVS_EP_REASON_SHORT_ANSWER      0x01    // script expects a short answer
+#define IVS_EP_REASON_LONG              0x02    // long utterance
+#define IVS_EP_REASON_FALLING           0x04    // energy is falling off (end of the phrase)
+#define IVS_EP_REASON_MID_SENTENCE      0x08    // stopped at full energy
+#define IVS_EP_REASON_MAX               0x10    // vad's own (max) hangover hit first
+
+#define IVS_DTMF_DIGITS_MAX             64
+#define IVS_DTMF_COLLECT_MAX_DIGITS     1
+#define IVS_DTMF_COLLECT_TERMINATOR     2
+#define IVS_DTMF_COLLECT_TIMEOUT        3
+#define IVS_DTMF_COLLECT_CANCELED       4
 
 #define IVS_EVENTSQ(ivs_session)     (ivs_session->events)
 
@@ -59,12 +78,31 @@ typedef struct {
     char                    *default_tts_engine;
     char                    *default_asr_engine;
     char                    *default_language;
+    char                    *cfg_chunk_store;
+    char                    *cfg_audio_filters;
     uint32_t                active_threads;
+    uint32_t                cfg_chunk_workers;
+    uint32_t                cfg_vad_engine;
+    uint32_t                cfg_vad_preroll_ms;
     uint32_t                cfg_cng_lvl;
     uint32_t                cfg_chunk_len_sec;
+    uint32_t                cfg_chunk_samplerate;
+    uint32_t                cfg_chunk_stream_ms;
+    uint32_t                cfg_chunk_overlap_ms;
+    uint32_t                cfg_chunk_compact_pause_ms;
+    uint32_t                cfg_opus_bitrate;
+    uint32_t                cfg_opus_complexity;
+    uint32_t                cfg_flac_level;
     uint32_t                cfg_vad_silence_ms;
     uint32_t                cfg_vad_voice_ms;
     uint32_t                cfg_vad_threshold;
+    uint32_t                cfg_echo_erl_db;
+    uint32_t                cfg_echo_tail_ms;
+    uint8_t                 cfg_echo_gate;
+    uint8_t                 cfg_barge_in;
+    uint8_t                 cfg_noise_suppression;
+    uint8_t                 cfg_chunk_compact;
+    uint8_t                 cfg_vad_adaptive;
     uint8_t                 cfg_vad_debug;
     uint8_t                 fl_ready;
     uint8_t                 fl_shutdown;
@@ -84,13 +122,67 @@ typedef struct {
     uint8_t                 fl_destroyed;
 } ivs_script_t;
 
+typedef struct ivs_vad_s ivs_vad_t;
+typedef struct ivs_echo_gate_s ivs_echo_gate_t;
+typedef struct ivs_denoise_s ivs_denoise_t;
+typedef struct ivs_filter_chain_s ivs_filter_chain_t;
+typedef struct ivs_endpoint_s ivs_endpoint_t;
+typedef struct ivs_events_queue_s ivs_events_queue_t;
+
+/* adaptive endpointer, how the utterance was closed */
+typedef struct {
+    uint32_t                timeout_ms;     // hangover used
+    uint32_t                speech_ms;
+    uint32_t                silence_ms;
+    uint32_t                reasons;        // IVS_EP_REASON_*
+} ivs_endpoint_decision_t;
+
+/* native digits collection (ivs.collectDigits), under the session mutex */
+typedef struct {
+    char                    digits[IVS_DTMF_DIGITS_MAX + 1];
+    char                    terminators[16];
+    uint32_t                digits_max;
+    uint32_t                digits_len;
+    uint32_t                timeout_ms;     // first / inter-digit
+    switch_time_t           last_ts;
+    uint8_t                 fl_active;
+} ivs_dtmf_collector_t;
+
+/* single producer / single consumer ring of fixed-size audio frames */
+typedef struct {
+    switch_byte_t           *data;
+    uint32_t                *slot_len;
+    uint32_t                *slot_flags;
+    uint32_t                slot_size;
+    uint32_t                slots;
+    uint32_t                head;       // producer
+    uint32_t                tail;       // consumer
+    uint32_t                overruns;
+    uint8_t                 fl_split;   // L16: larger frames go over several slots (encoded ones can't be cut)
+    uint8_t                 fl_oversize_logged;
+} audio_ring_t;
+
+/* last N frames before speech (media loop only) */
+typedef struct {
+    switch_byte_t           *data;
+    uint32_t                frame_size;
+    uint32_t                frames;
+    uint32_t                head;       // next slot to write
+    uint32_t                count;
+} audio_preroll_t;
+
 typedef struct {
     switch_core_session_t   *session;
     switch_mutex_t          *mutex;
     switch_mutex_t          *mutex_xflags;
-    switch_queue_t          *au_q_in;
-    switch_queue_t          *au_q_out;
-    switch_queue_t          *events;
+    switch_thread_cond_t    *cond_xflags;
+    audio_ring_t            *au_ring_in;
+    audio_ring_t            *au_ring_out;
+    ivs_events_queue_t      *events;
+    switch_buffer_t         *chunk_buffer;
+    switch_audio_resampler_t *chunk_resampler;  // codec rate -> chunk rate (worker only)
+    ivs_vad_t               *vad;
+    ivs_filter_chain_t      *filters;         // media thread (swapped under mutex)
     ivs_script_t            *script;
     const char              *session_id;
     const char              *caller_number;
@@ -98,32 +190,46 @@ typedef struct {
     const char              *language;
     const char              *tts_engine;
     const char              *asr_engine;
+    const char              *audio_filters;   // requested chain (spec)
     switch_vad_state_t      vad_state;
+    ivs_endpoint_decision_t ep_decision;    // last utterance (media thread -> chunks)
+    ivs_dtmf_collector_t    dtmf_collector;
     time_t                  start_ts;
     uint32_t                chunk_encoding;
     uint32_t                chunk_type;
+    uint32_t                chunk_mode;
+    uint32_t                chunk_samplerate;   // requested, 0 = codec rate
+    uint32_t                chunk_len_sec;      // requested, applied between chunks
+    uint32_t                chunk_rate;         // active (worker only)
+    uint32_t                chunk_utterance;    // assembler state (worker only)
+    uint32_t                chunk_seq;
+    uint32_t                chunk_emit_offs;
     uint32_t                job_id_cnt;
     uint32_t                wlocki;
+    uint32_t                vad_silence_ms;     // requested, 0 = engine default
+    uint32_t                vad_voice_ms;
+    uint32_t                vad_threshold;
     uint32_t                samplerate;
     uint32_t                channels;
     uint32_t                ptime;
     uint32_t                encoded_bytes_per_packet;
     uint32_t                decoded_bytes_per_packet;
-    uint32_t                vad_buffer_size;
+    uint32_t                vad_preroll_frames;
     uint32_t                chunk_buffer_size;
     uint32_t                xflags;
+    uint32_t                chunk_sched;    // IVS_WORKER_SCHED_*
+    uint32_t                chunk_worker;   // preferred worker
+    uint8_t                 fl_barge_in;
+    uint8_t                 fl_filters_changed;
+    uint8_t                 fl_chunk_compact;
+    uint8_t                 fl_vad_changed;
+    uint8_t                 fl_vad_adaptive;
+    uint8_t                 fl_short_answer;
     uint8_t                 fl_ready;
     uint8_t                 fl_do_destroy;
     uint8_t                 fl_destroyed;
 } ivs_session_t;
 
-typedef struct {
-    uint32_t    samplerate;
-    uint32_t    channels;
-    uint32_t    len;
-    uint8_t     *data;
-} xdata_buffer_t;
-
 /* utils.c */
 void launch_thread(switch_memory_pool_t *pool, switch_thread_start_t fun, void *data);
 void thread_finished();
@@ -133,12 +239,23 @@ uint32_t ivs_session_take(ivs_session_t *session);
 void ivs_session_release(ivs_session_t *session);
 int ivs_session_xflags_test(ivs_session_t *ivs_session, int flag);
 void ivs_session_xflags_set(ivs_session_t *ivs_session, int flag, int val);
+switch_status_t ivs_session_xflags_wait(ivs_session_t *ivs_session, int flag, int val, uint32_t timeout_ms);
 uint32_t ivs_gen_job_id(ivs_session_t *session);
 
-switch_status_t xdata_buffer_push(switch_queue_t *queue, switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint8_t channels);
-switch_status_t xdata_buffer_alloc(xdata_buffer_t **out, switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint8_t channels);
-void xdata_buffer_free(xdata_buffer_t *buf);
-void xdata_buffer_queue_clean(switch_queue_t *queue);
+switch_status_t audio_ring_create(audio_ring_t **ring, uint32_t slots, uint32_t slot_size, uint8_t fl_split, switch_memory_pool_t *pool);
+switch_status_t audio_ring_write(audio_ring_t *ring, switch_byte_t *data, uint32_t data_len);
+switch_status_t audio_ring_write_marker(audio_ring_t *ring, uint32_t flags);
+switch_status_t audio_ring_peek(audio_ring_t *ring, switch_byte_t **data, uint32_t *data_len, uint32_t *flags);
+void audio_ring_release(audio_ring_t *ring);
+void audio_ring_clean(audio_ring_t *ring);
+uint32_t audio_ring_overruns(audio_ring_t *ring);
+uint32_t audio_ring_count(audio_ring_t *ring);
+uint32_t audio_ring_write_frames(audio_ring_t *ring, switch_byte_t *data, uint32_t data_len, uint32_t frame_len);
+
+switch_status_t audio_preroll_create(audio_preroll_t **preroll, uint32_t frames, uint32_t frame_size, switch_memory_pool_t *pool);
+switch_status_t audio_preroll_write(audio_preroll_t *preroll, switch_byte_t *data, uint32_t data_len);
+uint32_t audio_preroll_spans(audio_preroll_t *preroll, switch_byte_t **span1, uint32_t *span1_len, switch_byte_t **span2, uint32_t *span2_len);
+void audio_preroll_reset(audio_preroll_t *preroll);
 
 char *audio_file_write(switch_byte_t *buf, uint32_t buf_len, uint32_t samplerate, uint32_t channels, const char *file_ext);
 
@@ -3,6 +3,7 @@
  * https://github.com/akscf/
  **/
 #include <mod_ivs.h>
+#include <ivs_chunk_store.h>
 
 extern globals_t globals;
 
@@ -54,9 +55,36 @@ void ivs_session_xflags_set(ivs_session_t *ivs_session, int flag, int val) {
     switch_mutex_lock(ivs_session->mutex_xflags);
     if(val) { BIT_SET(ivs_session->xflags, flag); }
     else { BIT_CLEAR(ivs_session->xflags, flag);  }
+    if(ivs_session->cond_xflags) { switch_thread_cond_broadcast(ivs_session->cond_xflags); }
     switch_mutex_unlock(ivs_session->mutex_xflags);
 }
 
+/**
+ * waits until the flag gets the value (or the session is going down)
+ **/
+switch_status_t ivs_session_xflags_wait(ivs_session_t *ivs_session, int flag, int val, uint32_t timeout_ms) {
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    switch_time_t expires = switch_micro_time_now() + (timeout_ms * 1000);
+    switch_assert(ivs_session);
+
+    switch_mutex_lock(ivs_session->mutex_xflags);
+    while(BIT_CHECK(ivs_session->xflags, flag) != !!val) {
+        if(globals.fl_shutdown || ivs_session->fl_destroyed) {
+            status = SWITCH_STATUS_FALSE;
+            break;
+        }
+        if(switch_micro_time_now() >= expires) {
+            status = SWITCH_STATUS_TIMEOUT;
+            break;
+        }
+        // short slices to notice destroy/shutdown
+        switch_thread_cond_timedwait(ivs_session->cond_xflags, ivs_session->mutex_xflags, 100000);
+    }
+    switch_mutex_unlock(ivs_session->mutex_xflags);
+
+    return status;
+}
+
 uint32_t ivs_session_take(ivs_session_t *session) {
     uint32_t status = false;
 
@@ -96,53 +124,240 @@ uint32_t ivs_gen_job_id(ivs_session_t *session) {
     return ret;
 }
 
-switch_status_t xdata_buffer_alloc(xdata_buffer_t **out, switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint8_t channels) {
-    xdata_buffer_t *buf = NULL;
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// audio ring: the media loop is the only producer and the chunk assembler (or the media loop for au_ring_in) is the only consumer,
+// so head/tail are published with acquire/release and no locks are needed on the hot path.
+switch_status_t audio_ring_create(audio_ring_t **ring, uint32_t slots, uint32_t slot_size, uint8_t fl_split, switch_memory_pool_t *pool) {
+    audio_ring_t *lring = NULL;
+    uint32_t n = 1;
+
+    switch_assert(pool);
+
+    if(!slots || !slot_size) {
+        return SWITCH_STATUS_FALSE;
+    }
+    while(n < slots) { n <<= 1; }
+
+    if((lring = switch_core_alloc(pool, sizeof(audio_ring_t))) == NULL) {
+        return SWITCH_STATUS_MEMERR;
+    }
+    if((lring->data = switch_core_alloc(pool, (n * slot_size))) == NULL) {
+        return SWITCH_STATUS_MEMERR;
+    }
+    if((lring->slot_len = switch_core_alloc(pool, (n * sizeof(uint32_t)))) == NULL) {
+        return SWITCH_STATUS_MEMERR;
+    }
+    if((lring->slot_flags = switch_core_alloc(pool, (n * sizeof(uint32_t)))) == NULL) {
+        return SWITCH_STATUS_MEMERR;
+    }
+
+    lring->slots = n;
+    lring->slot_size = slot_size;
+    lring->head = 0;
+    lring->tail = 0;
+    lring->overruns = 0;
+    lring->fl_split = fl_split;
+
+    *ring = lring;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * a frame larger than the slot (ptime/codec changed on re-INVITE) goes over several slots (fl_split),
+ * all of them or nothing, the consumer sees them as separate frames.
+ **/
+switch_status_t audio_ring_write(audio_ring_t *ring, switch_byte_t *data, uint32_t data_len) {
+    uint32_t head = 0, tail = 0, idx = 0, need = 1, offs = 0;
+
+    switch_assert(ring);
+
+    if(!data_len) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if(data_len > ring->slot_size) {
+        if(!ring->fl_split) {
+            if(!ring->fl_oversize_logged) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "audio ring: frame is larger than the slot (%u > %u), dropped\n", data_len, ring->slot_size);
+                ring->fl_oversize_logged = true;
+            }
+            __atomic_add_fetch(&ring->overruns, 1, __ATOMIC_RELAXED);
+            return SWITCH_STATUS_FALSE;
+        }
+        need = ((data_len + ring->slot_size - 1) / ring->slot_size);
+    }
 
-    switch_zmalloc(buf, sizeof(xdata_buffer_t));
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
 
-    if(data_len) {
-        switch_malloc(buf->data, data_len);
-        switch_assert(buf->data);
+    if((head - tail) + need > ring->slots) {
+        __atomic_add_fetch(&ring->overruns, 1, __ATOMIC_RELAXED);
+        return SWITCH_STATUS_FALSE;
+    }
 
-        buf->len = data_len;
-        buf->samplerate = samplerate;
-        buf->channels = channels;
+    for(uint32_t i = 0; i < need; i++) {
+        uint32_t len = MIN(ring->slot_size, data_len - offs);
 
-        memcpy(buf->data, data, data_len);
+        idx = ((head + i) & (ring->slots - 1));
+        memcpy(ring->data + (idx * ring->slot_size), data + offs, len);
+        ring->slot_len[idx] = len;
+        ring->slot_flags[idx] = 0;
+        offs += len;
     }
 
-    *out = buf;
+    __atomic_store_n(&ring->head, head + need, __ATOMIC_RELEASE);
     return SWITCH_STATUS_SUCCESS;
 }
 
-void xdata_buffer_free(xdata_buffer_t *buf) {
-    if(buf) {
-        switch_safe_free(buf->data);
-        switch_safe_free(buf);
+switch_status_t audio_ring_write_marker(audio_ring_t *ring, uint32_t flags) {
+    uint32_t head = 0, tail = 0, idx = 0;
+
+    switch_assert(ring);
+
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if((head - tail) >= ring->slots) {
+        __atomic_add_fetch(&ring->overruns, 1, __ATOMIC_RELAXED);
+        return SWITCH_STATUS_FALSE;
     }
+
+    idx = (head & (ring->slots - 1));
+    ring->slot_len[idx] = 0;
+    ring->slot_flags[idx] = flags;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return SWITCH_STATUS_SUCCESS;
 }
 
-void xdata_buffer_queue_clean(switch_queue_t *queue) {
-    void *data = NULL;
+switch_status_t audio_ring_peek(audio_ring_t *ring, switch_byte_t **data, uint32_t *data_len, uint32_t *flags) {
+    uint32_t head = 0, tail = 0, idx = 0;
 
-    if(!queue || !switch_queue_size(queue)) { return; }
+    switch_assert(ring);
 
-    while(switch_queue_trypop(queue, &data) == SWITCH_STATUS_SUCCESS) {
-        if(data) { xdata_buffer_free((xdata_buffer_t *) data); }
+    tail = ring->tail;
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if(head == tail) {
+        return SWITCH_STATUS_FALSE;
     }
+
+    idx = (tail & (ring->slots - 1));
+    *data = ring->data + (idx * ring->slot_size);
+    *data_len = ring->slot_len[idx];
+    if(flags) { *flags = ring->slot_flags[idx]; }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void audio_ring_release(audio_ring_t *ring) {
+    switch_assert(ring);
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+void audio_ring_clean(audio_ring_t *ring) {
+    if(!ring) { return; }
+    __atomic_store_n(&ring->tail, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
 }
 
-switch_status_t xdata_buffer_push(switch_queue_t *queue, switch_byte_t *data, uint32_t data_len, uint32_t samplerate, uint8_t channels) {
-    xdata_buffer_t *buff = NULL;
+uint32_t audio_ring_overruns(audio_ring_t *ring) {
+    return (ring ? __atomic_load_n(&ring->overruns, __ATOMIC_RELAXED) : 0);
+}
+
+uint32_t audio_ring_count(audio_ring_t *ring) {
+    if(!ring) { return 0; }
+    return (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+}
+
+uint32_t audio_ring_write_frames(audio_ring_t *ring, switch_byte_t *data, uint32_t data_len, uint32_t frame_len) {
+    uint32_t frames = 0;
+
+    switch_assert(ring && frame_len);
 
-    if(xdata_buffer_alloc(&buff, data, data_len, samplerate, channels) == SWITCH_STATUS_SUCCESS) {
-        if(switch_queue_trypush(queue, buff) == SWITCH_STATUS_SUCCESS) {
-            return SWITCH_STATUS_SUCCESS;
+    for(uint32_t offs = 0; offs < data_len; offs += frame_len) {
+        if(audio_ring_write(ring, data + offs, MIN(frame_len, data_len - offs)) == SWITCH_STATUS_SUCCESS) {
+            frames++;
         }
-        xdata_buffer_free(buff);
     }
-    return SWITCH_STATUS_FALSE;
+
+    return frames;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// pre-roll: circular store of the latest frames, read back (oldest first) as at most two spans, no copying
+switch_status_t audio_preroll_create(audio_preroll_t **preroll, uint32_t frames, uint32_t frame_size, switch_memory_pool_t *pool) {
+    audio_preroll_t *lpreroll = NULL;
+
+    switch_assert(pool);
+
+    if(!frames || !frame_size) {
+        return SWITCH_STATUS_FALSE;
+    }
+    if((lpreroll = switch_core_alloc(pool, sizeof(audio_preroll_t))) == NULL) {
+        return SWITCH_STATUS_MEMERR;
+    }
+    if((lpreroll->data = switch_core_alloc(pool, (frames * frame_size))) == NULL) {
+        return SWITCH_STATUS_MEMERR;
+    }
+
+    lpreroll->frames = frames;
+    lpreroll->frame_size = frame_size;
+
+    *preroll = lpreroll;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t audio_preroll_write(audio_preroll_t *preroll, switch_byte_t *data, uint32_t data_len) {
+    switch_byte_t *slot = NULL;
+
+    switch_assert(preroll);
+
+    if(!data_len || data_len > preroll->frame_size) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    slot = preroll->data + (preroll->head * preroll->frame_size);
+    memcpy(slot, data, data_len);
+    if(data_len < preroll->frame_size) {
+        memset(slot + data_len, 0, preroll->frame_size - data_len);
+    }
+
+    preroll->head = ((preroll->head + 1) % preroll->frames);
+    if(preroll->count < preroll->frames) { preroll->count++; }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+uint32_t audio_preroll_spans(audio_preroll_t *preroll, switch_byte_t **span1, uint32_t *span1_len, switch_byte_t **span2, uint32_t *span2_len) {
+    uint32_t first = 0;
+
+    switch_assert(preroll);
+
+    *span1 = NULL; *span1_len = 0;
+    *span2 = NULL; *span2_len = 0;
+
+    if(!preroll->count) {
+        return 0;
+    }
+
+    first = ((preroll->head + preroll->frames - preroll->count) % preroll->frames);
+    if(first + preroll->count <= preroll->frames) {
+        *span1 = preroll->data + (first * preroll->frame_size);
+        *span1_len = (preroll->count * preroll->frame_size);
+    } else {
+        *span1 = preroll->data + (first * preroll->frame_size);
+        *span1_len = ((preroll->frames - first) * preroll->frame_size);
+        *span2 = preroll->data;
+        *span2_len = (preroll->head * preroll->frame_size);
+    }
+
+    return preroll->count;
+}
+
+void audio_preroll_reset(audio_preroll_t *preroll) {
+    if(!preroll) { return; }
+    preroll->head = 0;
+    preroll->count = 0;
 }
 
 char *audio_file_write(switch_byte_t *buf, uint32_t buf_len, uint32_t samplerate, uint32_t channels, const char *file_ext) {
@@ -154,7 +369,7 @@ char *audio_file_write(switch_byte_t *buf, uint32_t buf_len, uint32_t samplerate
     int flags = (SWITCH_FILE_FLAG_WRITE | SWITCH_FILE_DATA_SHORT);
 
     switch_uuid_str((char *)name_uuid, sizeof(name_uuid));
-    file_name = switch_mprintf("%s%s%s.%s", SWITCH_GLOBAL_dirs.temp_dir, SWITCH_PATH_SEPARATOR, name_uuid, (file_ext == NULL ? "wav" : file_ext) );
+    file_name = switch_mprintf("%s%s%s.%s", ivs_chunk_store_dir(), SWITCH_PATH_SEPARATOR, name_uuid, (file_ext == NULL ? "wav" : file_ext) );
 
     if((status = switch_core_file_open(&fh, file_name, channels, samplerate, flags, NULL)) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Open fail: %s\n", file_name);